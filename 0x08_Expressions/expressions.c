@@ -2,23 +2,31 @@
 #include <stdlib.h>
 #include <memory.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
 #define int long long // Work with 64-bit machines
 
-int poolsz;           // default size of text/data/stack
+int poolsz;           // reserved size of text/data/stack
 int line;             // line number
 char *src, *old_src;  // pointer to source code string
 int token;            // current token
 
 // memory allocation sections
-// without considering virtual memory mapping
+// every section is a large reservation of virtual memory, and its pages are
+// committed on demand at the points where it grows (see `grow()`)
 //
 //    *text: text section
 //    *old_text: for dumping text section
 //    *stack: stack section
+//    *tags: relocation tags, parallel to text section
 
 int *text, *old_text;  // text section
 int *stack;            // stack section
-char *data;            // data section
+char *data, *old_data; // data section
+int *tags;             // relocation tags
+int *text_pool, *tags_pool, *data_pool, *symbol_pool, *link_pool, *include_pool, *case_pool;
 
 // ----- Virtual Machine ----- //
 //    *pc:   program counter
@@ -28,17 +36,19 @@ char *data;            // data section
 //    cycle: 
 
 int *pc, *bp, *sp, gpr, cycle;
+int timing;  // report the startup latency
 // support CPU instructions (x86)
-enum { LEA,  IMM,  JMP,  CALL, JZ,   JNZ,  ENT,  ADJ, LEV, LI,  LC,  SI,  SC,  PUSH, 
-       OR,   XOR,  AND,  EQ,   NE,   LT,   GT,   LE,  GE,  SHL, SHR, ADD, SUB, MUL,  DIV, MOD, 
-       OPEN, READ, CLOS, PRTF, MALC, MSET, MCMP, EXIT };
+enum { LEA,  IMM,  JMP,  CALL, JZ,   JNZ,  JTAB, JBIN, LSP,  INC,  ENT, MENT, ADJ, LEV, RET, MRET, LI,  LC,  SI,  SC,  PUSH, 
+       OR,   XOR,  AND,  EQ,   NE,   LT,   GT,   LE,  GE,  SHL, SHR, ADD, SUB, MUL,  DIV, MOD, NEG,
+       OPEN, READ, CLOS, PRTF, MALC, MSET, MCMP, WRIT, MMAP, MPRT, CLCK, LSEK, RENM,
+       MCPY, MFIL, SLEN, MSUM, EXIT };
 
 
 // ----- Lexer ----- //
 // tokens
 // ordered by their precedences from low to high
 enum { Num = 128, Fun, Sys, Glo, Loc, Id, 
-       Char, Else, Enum, If, Int, Return, Sizeof, While, 
+       Break, Case, Char, Default, Else, Enum, If, Int, Return, Sizeof, Switch, While, 
        Assign, Cond, Lor, Lan, Or, Xor, And, Eq, Ne, Lt, Gt, Le, Ge, Shl, Shr, Add, Sub, Mul, Div, Mod, Inc, Dec, Brak };
 // variable identifier table
 // struct identifier { 
@@ -57,7 +67,7 @@ int token_val;      // value of current token (mainly for number)
 int *curr_id;       // current parsed ID
 int *symbols;       // symbol table
 // fields of identifier
-enum { Token, Hash, Name, Type, Class, Value, BType, BClass, BValue, IdSize };
+enum { Token, Hash, Name, Type, Class, Value, BType, BClass, BValue, Link, IdSize };
 
 // types of variables/functions
 enum { CHAR, INT, PTR };
@@ -67,12 +77,196 @@ int *idmain;             // the main function
 int basetype;    // the type of declaration
 int expr_type;   // the type of an expression
 int index_of_bp; // index of bp pointer on stack
+int branching;   // `&&` and `||` of the next expression jump to the targets
+int *jumps_true; //     of a condition, whose jumps are chained through
+int *jumps_false;//     their operands
+int discarded;   // the value of the next expression is not used
+
+// variables for statement requirements
+int *breaks;        // jumps of `break`, chained through their operands
+int loops;          // depth of the statements which `break` leaves
+int *cases;         // value and address of every case of the switches being parsed
+int num_cases;
+int switch_cases;   // index of the first case of the innermost switch
+int *switch_default;// address of its default label, 0 if none
+int switches;       // depth of switch statements
+
+// ----- Linker ----- //
+// Translation units are compiled one after another into the same text and
+// data sections, so nothing has to be moved for units compiled in-process.
+// Operands which refer to other units are tagged in `tags`:
+//    0:      plain operand
+//    RDATA:  address inside the data section (string literals)
+//    others: pointer to the identifier the operand refers to, which is
+//            replaced by its entry of the link table when the unit ends
+// struct link {
+//     int hash;         // same hash as the symbol table
+//     char *name;       // name of the symbol, not NUL terminated
+//     int len;          // length of the name
+//     int class;        // Fun or Glo
+//     int type;         // type of the symbol
+//     int value; };     // address of the definition, 0 if not defined yet
+int *links;         // link table, shared by all translation units
+enum { LHash, LName, LLen, LClass, LType, LValue, LinkSize };
+enum { RDATA = 1 };
+enum { OBJMAGIC = 0x346f3463 }; // "c4o4", the first word of an object file
+
+// ----- Include ----- //
+// `#include "file"` is compiled once per unit, and the result of compiling
+// an included file is cached on disk next to it (file.c4c). The cache is
+// reused when the content of the file (and of the files it includes) is
+// unchanged, and when it doesn't depend on identifiers declared before it.
+// struct include {
+//     char *src;        // position in the including file
+//     int line;         // line number in the including file
+//     char *path;       // path of the including file
+//     int hash;         // content hash of the included file
+//     int len;          // length of the included file
+//     int *text;        // end of text/data/symbols before the included file,
+//     char *data;       //     what comes after is compiled from it
+//     int *symbols;
+//     int included;     // number of files included before it
+//     int cache; };     // whether the result can be cached
+enum { ISrc, ILine, IPath, IHash, ILen, IText, IData, ISymbols, IIncluded, ICache, IncSize };
+enum { INCMAX = 64 };           // maximum depth of nested includes
+enum { CACHEMAGIC = 0x326d3463 }; // "c4m2", the first word of a cache file
+int *includes;       // stack of included files, starting from 1
+int include_depth;
+int *included;       // files included by the unit: hash, len, path
+int num_included;
+char *src_path;      // path of the file being compiled
+int *keywords_end;   // identifiers before it are pre-built
+int in_function;     // includes in a function body are not cached
+int map_len;         // length of the file last read by `map_file()`
+
+int end_include();
+void depend(int *id);
+void begin_include(char *name, int len);
+
+// ----- Optimizer ----- //
+// With `-O`, every function is decoded into instructions after it is
+// compiled, rewritten, and encoded back in place. Operands of jumps are
+// indexes of instructions while decoded, so instructions can be removed
+// without fixing the jumps by hand.
+// struct instruction {
+//     int op;           // opcode, NOP if removed
+//     int arg;          // operand, index of the target instruction for jumps
+//     int tag;          // relocation tag of the operand
+//     int label;        // number of jumps to it
+//     int fixed;        // part of a jump table, to be kept as it is
+//     int addr;         // address when encoded
+//     int escape;       // of a LEA, whether the address of the local escapes
+//     int save; };      // the value of the expression beginning here is to be
+//                       // saved to the local `save` (< 0), or it ends here (> 0)
+enum { IOp, IArg, ITag, ILabel, IFixed, IAddr, IEscape, ISave, InsSize };
+enum { NOP = 256, END };  // removed instruction, and the one after the last
+enum { INLINE_MAX = 16 }; // maximum number of instructions of inlined functions
+enum { CSE_WINDOW = 1024 }; // instructions searched for the copies of an expression
+int opt_level;       // level of optimization, 0 for none
+int verbose;         // report the size of every optimized function
+int *insns;          // decoded instructions of the function
+int num_insns;
+int *insn_at;        // index of the instruction at every word of the function
+int *opt_pool;
+
+// With `-O2`, the values of the locals and arguments whose addresses are not
+// taken are followed through the control flow of the function, like in SSA
+// form: every store makes a new value of the variable, and where paths join,
+// the values coming from all of them are merged (the phi nodes). A value is
+// a constant, a copy of another variable, or anything. Loads of constants and
+// copies are replaced, and stores of values which are never loaded are removed.
+enum { VUndef, VConst, VCopy, VAny, VarSize };  // VUndef: not reached yet
+int num_vars;        // number of variables of the frame
+int first_var;       // offset of the first one to bp
+int *var_tracked;    // whether the address of every variable is not taken
+int *var_states;     // kind and value of every variable before every instruction
+
+// Calls of pure functions with constant arguments are run at compile time,
+// in a sandbox with a stack of its own and a budget of cycles.
+enum { FOLD_CYCLES = 1000000, FOLD_STACK = 65536, PURE_DEPTH = 8 };
+int *fold_stack;     // stack of the sandbox
+
+void optimize(int *id);
+int *next_function(int *f);
+int *find_case(int *table, int value);
+
+// ----- Memory Pools ----- //
+// struct pool {
+//     char *name;       // name of the section, for error messages
+//     int base;         // start of the reservation
+//     int commit;       // end of the committed pages
+//     int limit; };     // end of the reservation
+enum { PName, PBase, PCommit, PLimit, PoolSize };
+enum { CHUNK = 65536 };  // pages are committed by chunks
+// mmap(2) and mprotect(2) arguments on Linux
+enum { PROT_RO = 1, PROT_RW = 3, MAP_FILE_FIXED = 0x12, MAP_ANON_PRIVATE = 0x22, MAP_ANON_RESERVE = 0x4022 };
+
+int *new_pool(char *name, int size) {
+    // reserve address space for a section, nothing is committed yet
+    int *pool;
+    int base;
+
+    base = (int)mmap(0, size, 0, MAP_ANON_RESERVE, -1, 0);
+    if (base==-1 || !(pool = malloc(PoolSize * sizeof(int)))) {
+        printf("Could not reserve %d bytes for %s area\n", size, name);
+        exit(-1);
+    }
+    pool[PName]   = (int)name;
+    pool[PBase]   = base;
+    pool[PCommit] = base;
+    pool[PLimit]  = base + size;
+    return pool;
+}
+
+void grow(int *pool, int addr) {
+    // make sure the pages of the pool are committed up to `addr`
+    int end;
+
+    if (addr<pool[PCommit]) {
+        return ;
+    }
+    end = (addr + CHUNK) & -CHUNK;
+    if (end>pool[PLimit]) {
+        end = pool[PLimit];
+    }
+    if (addr>=end || mprotect((char *)pool[PCommit], end - pool[PCommit], PROT_RW)) {
+        printf("%d: Out of memory in %s area\n", line, (char *)pool[PName]);
+        exit(-1);
+    }
+    pool[PCommit] = end;
+}
+
+void reserve_text(int n) {
+    // make room for `n` more words of text, the tags grow along with it
+    grow(text_pool, (int)(text + n));
+    grow(tags_pool, (int)(tags + (text - old_text) + n));
+}
+
+int *lookup(int hash, char *name, int len) {
+    // look for existing identifier, linear search
+    int *id;
+    id = symbols;
+    while (id[Token]) {
+        if (id[Hash]==hash && !memcmp((char *)id[Name], name, len)) {
+            // found one, return
+            return id;
+        }
+        id = id + IdSize;
+    }
+
+    // store new ID
+    grow(symbol_pool, (int)(id + IdSize));
+    id[Name] = (int)name;
+    id[Hash] = hash;
+    id[Token] = Id;
+    return id;
+}
 
 void next() {
     char *last_pos;
-    int hash;
+    int hash, len;
 
-    while (token = *src) {
+    while ((token = *src) || (token = end_include())) {
         ++src;
 
         // parse token here
@@ -82,8 +276,21 @@ void next() {
 
         } else if (token=='#') {
             // MACRO
-            // skip macro, which it's not supported in our compiler
+            // `#include "file"` is supported, other macros are skipped
+            last_pos = 0;
+            if (!memcmp(src, "include", 7)) {
+                src = src + 7;
+                while (*src==' ' || *src=='\t') src++;
+                if (*src=='"') {
+                    last_pos = ++src;
+                    while (*src!=0 && *src!='\n' && *src!='"') src++;
+                    len = src - last_pos;
+                }
+            }
             while (*src!=0 && *src!='\n') src++;
+            if (last_pos) {
+                begin_include(last_pos, len);
+            }
 
         } else if ((token>='a' && token<='z') || (token>='A' && token<='Z') || (token=='_')) {
             // IDENTIFIERS and SYMBOL TABLE
@@ -96,21 +303,11 @@ void next() {
                 src++;
             }
 
-            // look for existing identifier, linear search
-            curr_id = symbols;
-            while (curr_id[Token]) {
-                if (curr_id[Hash]==hash && !memcmp((char *)curr_id[Name], last_pos, src - last_pos)) {
-                    // found one, return
-                    token = curr_id[Token];
-                    return ;
-                }
-                curr_id = curr_id + IdSize;
+            curr_id = lookup(hash, last_pos, src - last_pos);
+            token = curr_id[Token];
+            if (include_depth && curr_id[Class] && curr_id>=keywords_end) {
+                depend(curr_id);
             }
-
-            // store new ID
-            curr_id[Name] = (int)last_pos;
-            curr_id[Hash] = hash;
-            token = curr_id[Token] = Id;
             return ;
 
         } else if (token>='0' && token<='9') {
@@ -153,6 +350,7 @@ void next() {
                 }
                 
                 if (token=='"') {
+                    grow(data_pool, (int)data);
                     *data++ = token_val;
                 }
             }
@@ -301,12 +499,244 @@ void match(int tk) {
     }
 }
 
+void reloc(int tag) {
+    // tag the operand which is just emitted
+    tags[text - old_text] = tag;
+}
+
+int has_arg(int op) {
+    // instructions followed by an operand
+    return op<=ADJ;
+}
+
+int is_jump(int op) {
+    return op==JMP || op==JZ || op==JNZ;
+}
+
+void emit_copy(int *from, int *to) {
+    // emit a copy of the code after `from` up to `to`,
+    // jumps inside the code are moved along with it
+    int *p, delta;
+    reserve_text(to - from + 64);
+    delta = (int)text - (int)from;
+    p = from;
+    while (p<to) {
+        *++text = *++p;
+        if (has_arg(*p)) {
+            *++text = *++p;
+            tags[text - old_text] = tags[p - old_text];
+            if (is_jump(p[-1]) && *p>(int)from && *p<=(int)(to + 1)) {
+                *text = *text + delta;
+            }
+        }
+    }
+}
+
+void patch(int *jumps, int *addr) {
+    // make the chain of jumps go to `addr`
+    int *next;
+    while (jumps) {
+        next = (int *)*jumps;
+        *jumps = (int)addr;
+        jumps = next;
+    }
+}
+
+int is_const(int *start) {
+    // whether the code emitted after `start` only loads a constant,
+    // which is an `IMM` without relocation
+    return text==start + 2 && start[1]==IMM && !tags[text - old_text];
+}
+
+int foldable(int op, int a, int b) {
+    // whether `a op b` may be computed by the compiler: the operations which
+    // trap or are undefined in C, a division by zero or of the smallest
+    // number by -1, and shifts by a negative count or by 64 or more, are left
+    // to the runtime
+    if (op==DIV || op==MOD) {
+        return b && (b!=-1 || a!=-9223372036854775807 - 1);
+    } else if (op==SHL || op==SHR) {
+        return b>=0 && b<64;
+    }
+    return 1;
+}
+
+int fold(int op, int a, int b) {
+    // the result of a binary operator on constants
+    if      (op==OR)  { a = a |  b; }
+    else if (op==XOR) { a = a ^  b; }
+    else if (op==AND) { a = a &  b; }
+    else if (op==EQ)  { a = a == b; }
+    else if (op==NE)  { a = a != b; }
+    else if (op==LT)  { a = a <  b; }
+    else if (op==LE)  { a = a <= b; }
+    else if (op==GT)  { a = a >  b; }
+    else if (op==GE)  { a = a >= b; }
+    else if (op==SHL) { a = a << b; }
+    else if (op==SHR) { a = a >> b; }
+    else if (op==ADD) { a = a +  b; }
+    else if (op==SUB) { a = a -  b; }
+    else if (op==MUL) { a = a *  b; }
+    else if (op==DIV) { a = a /  b; }
+    else if (op==MOD) { a = a %  b; }
+    return a;
+}
+
+int power_of_two(int n) {
+    // the exponent if `n` is a power of two, -1 otherwise
+    int k;
+
+    if (n<=0 || (n & (n - 1))) {
+        return -1;
+    }
+    k = 0;
+    while (n>1) {
+        n = n >> 1;
+        k++;
+    }
+    return k;
+}
+
+int leaf_length(int *start) {
+    // number of words of the operand after `start` if it only loads a
+    // constant or a variable, 0 otherwise
+    if (start[1]==IMM && start[3]==PUSH) {
+        return 2;
+    } else if ((start[1]==LEA || start[1]==IMM) && (start[3]==LI || start[3]==LC) && start[4]==PUSH) {
+        return 3;
+    }
+    return 0;
+}
+
+int reorder(int op, int *start) {
+    // evaluate the operand which needs more of the stack first, like in
+    // Sethi-Ullman numbering: a constant or a variable on the left of a
+    // commutative operator goes to the right when the right operand pushes
+    // words itself, or isn't a constant, returns the operator to emit
+    //
+    // ----- origin -----       ----- reordered -----
+    // <leaf>                   <expr>
+    // PUSH                     PUSH
+    // <expr>                   <leaf>
+    // <op>                     <op>
+    //
+    // then the stack is one word lower while <expr> is computed, and a
+    // constant on the right may be folded into the operator; comparisons
+    // are mirrored, and operands with side effects keep their order
+    int *p, n, pushes, depth, w1, w2, w3, t1, t2, t3, pure;
+
+    if (op!=OR && op!=XOR && op!=AND && op!=EQ && op!=NE && op!=LT && op!=GT
+        && op!=LE && op!=GE && op!=ADD && op!=MUL) {
+        return op;
+    }
+    n = leaf_length(start);
+    if (!n || is_const(start + n + 1)) {
+        return op;
+    }
+    // the right operand must take the whole stack it pushes, otherwise the
+    // PUSH after the leaf belongs to a larger left operand
+    pushes = depth = 0;
+    pure = 1;
+    p = start + n + 2;
+    while (p<=text) {
+        if (is_jump(*p) || *p==JTAB || *p==JBIN) {
+            return op;
+        } else if (*p==PUSH) {
+            pushes++;
+            depth++;
+        } else if (*p==ADJ) {
+            depth = depth - p[1];
+        } else if (*p==SI || *p==SC || (*p>=OR && *p<=MOD)) {
+            depth--;
+        }
+        if (*p==SI || *p==SC || *p==INC || *p==CALL || *p>=OPEN) {
+            pure = 0;
+        }
+        if (depth<0) {
+            return op;
+        }
+        p = p + 1 + has_arg(*p);
+    }
+    if (depth || (n==3 && !pure) || (!pushes && (n==3 || tags[start + 2 - old_text]))) {
+        return op;
+    }
+
+    // rotate the code, with the relocation tags
+    w1 = start[1]; w2 = start[2]; w3 = start[3];
+    t1 = tags[start + 1 - old_text]; t2 = tags[start + 2 - old_text]; t3 = tags[start + 3 - old_text];
+    p = start + n + 2;
+    while (p<=text) {
+        p[-n - 1] = *p;
+        tags[p - n - 1 - old_text] = tags[p - old_text];
+        p++;
+    }
+    p = text - n;
+    *p = PUSH;
+    tags[p - old_text] = 0;
+    p[1] = w1; p[2] = w2;
+    tags[p + 1 - old_text] = t1; tags[p + 2 - old_text] = t2;
+    if (n==3) {
+        p[3] = w3;
+        tags[p + 3 - old_text] = t3;
+    }
+
+    if      (op==LT) { op = GT; }
+    else if (op==GT) { op = LT; }
+    else if (op==LE) { op = GE; }
+    else if (op==GE) { op = LE; }
+    return op;
+}
+
+void emit_op(int op, int *start) {
+    // emit a binary operator whose left operand begins after `start`, once
+    // the operands are put in order by `reorder()`,
+    // both operands are folded into one constant if they are constants,
+    // and a multiplication by a power of two becomes a shift
+    //
+    // ----- origin -----       ----- folded -----
+    // IMM <a>                  IMM <a op b>
+    // PUSH
+    // IMM <b>
+    // <op>
+    //
+    // PUSH                     PUSH
+    // IMM <2^k>                IMM <k>
+    // MUL                      SHL
+    int a, b;
+
+    op = reorder(op, start);
+    b = *text;
+    if (!is_const(start + 3) || start[3]!=PUSH || start[1]!=IMM || tags[start + 2 - old_text]
+        || !foldable(op, start[2], b)) {
+        if (op==MUL && text[-2]==PUSH && is_const(text - 2) && power_of_two(b)>0) {
+            *text = power_of_two(b);
+            op = SHL;
+        }
+        *++text = op;
+        return ;
+    }
+
+    a = fold(op, start[2], b);
+    text = start;
+    *++text = IMM;
+    *++text = a;
+}
+
 void expression(int level) {
     
     // UNARY OPERATORS
     int *id;
     int tmp;
     int *addr;
+    int *start;      // the code of this expression begins after `start`
+    int branch;      // whether it's the condition of a statement
+    int unused;      // whether its value is not used
+    reserve_text(64);
+    start = text;
+    branch = branching;
+    branching = 0;
+    unused = discarded;
+    discarded = 0;
     if (!token) {
         printf("%d: Unexpected token EOF of expression\n", line);
         exit(-1);
@@ -325,6 +755,7 @@ void expression(int level) {
         // continuous string
         *++text = IMM;
         *++text = token_val;
+        reloc(RDATA);
         match('"');
 
         while (token=='"') {
@@ -334,6 +765,7 @@ void expression(int level) {
         // append EOF, namely '\0', to a string
         // since all the data are default to 0, we can just move data 1 position forward
         data = (char *)( ((int)data + sizeof(int)) & (-sizeof(int)) );
+        grow(data_pool, (int)data);   // the '\0' may begin a new page
         expr_type = PTR;
 
     } else if (token==Sizeof) {
@@ -396,16 +828,20 @@ void expression(int level) {
 
             } else if (id[Class]==Fun) {
                 // function call
+                // the address is filled by the linker, since the function
+                // may only be declared in this unit
                 *++text = CALL;
                 *++text = id[Value];
+                reloc((int)id);
 
             } else {
                 printf("%d: Bad function call\n", line);
                 exit(-1);
             }
 
-            // clean the stack for arguments
-            if (tmp>0) {
+            // clean the stack for arguments, a function pops them when it
+            // returns, and finds their number in the ADJ after the call
+            if (tmp>0 || id[Class]==Fun) {
                 *++text = ADJ;
                 *++text = tmp;
             }
@@ -428,6 +864,7 @@ void expression(int level) {
             } else if (id[Class]==Glo) {
                 *++text = IMM;
                 *++text = id[Value];
+                reloc((int)id);
             } else {
                 printf("%d: Undefined variable\n", line);
                 exit(-1);
@@ -437,7 +874,7 @@ void expression(int level) {
             // which is stored in `gpr`
             // load the value of variables using `LI/LC` according to their type
             expr_type = id[Type];
-            *++text = (expr_type==Char) ? LC : LI;
+            *++text = (expr_type==CHAR) ? LC : LI;
         }
 
     } else if (token=='(') {
@@ -497,7 +934,7 @@ void expression(int level) {
         *++text = PUSH;
         *++text = IMM;
         *++text = 0;
-        *++text = EQ;
+        emit_op(EQ, start);
 
         expr_type = INT;
 
@@ -512,7 +949,7 @@ void expression(int level) {
         *++text = PUSH;
         *++text = IMM;
         *++text = -1;
-        *++text = XOR;
+        emit_op(XOR, start);
 
         expr_type = INT;
 
@@ -537,7 +974,7 @@ void expression(int level) {
             *++text = -1;
             *++text = PUSH;
             expression(Inc);
-            *++text = MUL;
+            emit_op(MUL, start);
         }
 
         expr_type = INT;
@@ -548,27 +985,29 @@ void expression(int level) {
         // and for `++p`, we have to access `p` twice
         // 1. for load the value
         // 2. for storing the incremented value
+        // an int or a pointer is incremented in place by `INC`
         tmp = token;
         match(token);
         expression(Inc);
 
-        if (*text==LC) {
+        if (*text==LI) {
+            *text = INC;
+            *++text = (expr_type>PTR) ? sizeof(int) : sizeof(char);
+            if (tmp==Dec) {
+                *text = -*text;
+            }
+        } else if (*text==LC) {
             *text = PUSH;           // to duplicate the address
             *++text = LC;
-        } else if (*text==LI) {
-            *text = PUSH;           // to duplicate the address
-            *++text = LI;
+            *++text = PUSH;
+            *++text = IMM;
+            *++text = sizeof(char);
+            *++text = (tmp==Inc) ? ADD : SUB;
+            *++text = SC;
         } else {
             printf("%d: Bad lvalue of pre-increment\n", line);
             exit(-1);
         }
-        *++text = PUSH;
-        *++text = IMM;
-
-        // deal with the cases when `p` is a pointer
-        *++text = (expr_type>PTR) ? sizeof(int) : sizeof(char);
-        *++text = (tmp==Inc) ? ADD : SUB;
-        *++text = (expr_type==CHAR) ? SC : SI;
 
     }
 
@@ -610,6 +1049,13 @@ void expression(int level) {
         } else if (token==Cond) {
             // expr ? a : b;
             match(Cond);
+            if (branch) {
+                // the value of the condition is used after all
+                patch(jumps_true, text + 1);
+                patch(jumps_false, text + 1);
+                jumps_true = jumps_false = 0;
+                branch = 0;
+            }
 
             *++text = JZ;
             addr = ++text;
@@ -626,6 +1072,28 @@ void expression(int level) {
             expression(Cond);
             *addr = (int)(text + 1);
 
+        } else if (token==Lor && branch) {
+            // logical or in a condition, <expr1> jumps to the true target,
+            // and the false jumps before go on to <expr2>
+            match(Lor);
+            *++text = JNZ;
+            *++text = (int)jumps_true;
+            jumps_true = text;
+            patch(jumps_false, text + 1);
+            jumps_false = 0;
+            branching = 1;
+            expression(Lan);
+            expr_type = INT;
+
+        } else if (token==Lan && branch) {
+            // logical and in a condition, <expr1> jumps to the false target
+            match(Lan);
+            *++text = JZ;
+            *++text = (int)jumps_false;
+            jumps_false = text;
+            expression(Or);
+            expr_type = INT;
+
         } else if (token==Lor) {
             // logical or:
             //   <expr1> || <expr2>
@@ -644,6 +1112,14 @@ void expression(int level) {
             *addr = (int)(text + 1);
             expr_type = INT;
 
+            if (start[1]==IMM && !tags[start + 2 - old_text] && addr==start + 4 && is_const(addr)) {
+                // fold constant operands: <expr1> ? <expr1> : <expr2>
+                tmp = start[2] ? start[2] : *text;
+                text = start;
+                *++text = IMM;
+                *++text = tmp;
+            }
+
         } else if (token==Lan) {
             // logical and
             //   <expr1> && <expr2>
@@ -662,6 +1138,14 @@ void expression(int level) {
             *addr = (int)(text + 1);
             expr_type = INT;
 
+            if (start[1]==IMM && !tags[start + 2 - old_text] && addr==start + 4 && is_const(addr)) {
+                // fold constant operands: <expr1> ? <expr2> : <expr1>
+                tmp = start[2] ? *text : start[2];
+                text = start;
+                *++text = IMM;
+                *++text = tmp;
+            }
+
     
         // MATHEMATICAL OPERATIONS
         // including |, ^, &, ==, !=, <=, >=, <, >, <<, >>, +, -, *, /, %
@@ -681,7 +1165,7 @@ void expression(int level) {
 
             *++text = PUSH;
             expression(Xor);
-            *++text = OR;
+            emit_op(OR, start);
             expr_type = INT;
 
         } else if (token==Xor) {
@@ -690,7 +1174,7 @@ void expression(int level) {
 
             *++text = PUSH;
             expression(And);
-            *++text = XOR;
+            emit_op(XOR, start);
             expr_type = INT;
 
         } else if (token==And) {
@@ -699,7 +1183,7 @@ void expression(int level) {
 
             *++text = PUSH;
             expression(Eq);
-            *++text = AND;
+            emit_op(AND, start);
             expr_type = INT;
 
         } else if (token==Eq) {
@@ -708,7 +1192,7 @@ void expression(int level) {
 
             *++text = PUSH;
             expression(Ne);
-            *++text = EQ;
+            emit_op(EQ, start);
             expr_type = INT;
 
         } else if (token==Ne) {
@@ -717,7 +1201,7 @@ void expression(int level) {
 
             *++text = PUSH;
             expression(Lt);
-            *++text = NE;
+            emit_op(NE, start);
             expr_type = INT;
 
         } else if (token==Lt) {
@@ -726,7 +1210,7 @@ void expression(int level) {
 
             *++text = PUSH;
             expression(Shl);
-            *++text = LT;
+            emit_op(LT, start);
             expr_type = INT;
 
         } else if (token==Gt) {
@@ -735,7 +1219,7 @@ void expression(int level) {
 
             *++text = PUSH;
             expression(Shl);
-            *++text = GT;
+            emit_op(GT, start);
             expr_type = INT;
 
         } else if (token==Le) {
@@ -744,7 +1228,7 @@ void expression(int level) {
 
             *++text = PUSH;
             expression(Shl);
-            *++text = LE;
+            emit_op(LE, start);
             expr_type = INT;
 
         } else if (token==Ge) {
@@ -753,7 +1237,7 @@ void expression(int level) {
 
             *++text = PUSH;
             expression(Shl);
-            *++text = GE;
+            emit_op(GE, start);
             expr_type = INT;
 
         } else if (token==Shl) {
@@ -762,7 +1246,7 @@ void expression(int level) {
 
             *++text = PUSH;
             expression(Add);
-            *++text = SHL;
+            emit_op(SHL, start);
             expr_type = INT;
 
         } else if (token==Shr) {
@@ -771,7 +1255,7 @@ void expression(int level) {
 
             *++text = PUSH;
             expression(Add);
-            *++text = SHR;
+            emit_op(SHR, start);
             expr_type = INT;
 
         // there are still some more important cases need to be handled
@@ -799,6 +1283,7 @@ void expression(int level) {
             match(Add);
 
             *++text = PUSH;
+            addr = text;
             expression(Mul);
             expr_type = tmp;
 
@@ -807,23 +1292,25 @@ void expression(int level) {
                 *++text = PUSH;
                 *++text = IMM;
                 *++text = sizeof(int);
-                *++text = MUL;
+                emit_op(MUL, addr);
             }
-            *++text = ADD;
+            emit_op(ADD, start);
 
         } else if (token==Sub) {
             // subtraction
             match(Sub);
 
             *++text = PUSH;
+            addr = text;
             expression(Mul);
             if (tmp>PTR && tmp==expr_type) {
-                // pointer subtraction
-                *++text = SUB;
+                // pointer subtraction, the difference is a multiple of
+                // the size, so it is shifted instead of divided
+                emit_op(SUB, start);
                 *++text = PUSH;
                 *++text = IMM;
-                *++text = sizeof(int);
-                *++text = DIV;
+                *++text = power_of_two(sizeof(int));
+                emit_op(SHR, start);
                 expr_type = INT;
 
             } else if (tmp>PTR) {
@@ -831,13 +1318,13 @@ void expression(int level) {
                 *++text = PUSH;
                 *++text = IMM;
                 *++text = sizeof(int);
-                *++text = MUL;
-                *++text = SUB;
+                emit_op(MUL, addr);
+                emit_op(SUB, start);
                 expr_type = tmp;
 
             } else {
                 // numerical substraction
-                *++text = SUB;
+                emit_op(SUB, start);
                 expr_type = tmp;
             }
 
@@ -847,7 +1334,7 @@ void expression(int level) {
 
             *++text = PUSH;
             expression(Inc);
-            *++text = MUL;
+            emit_op(MUL, start);
             expr_type = tmp;
 
         } else if (token==Div) {
@@ -856,7 +1343,7 @@ void expression(int level) {
 
             *++text = PUSH;
             expression(Inc);
-            *++text = DIV;
+            emit_op(DIV, start);
             expr_type = tmp;
 
         } else if (token==Mod) {
@@ -865,7 +1352,7 @@ void expression(int level) {
 
             *++text = PUSH;
             expression(Inc);
-            *++text = MOD;
+            emit_op(MOD, start);
             expr_type = tmp;
 
         } else if (token==Inc || token==Dec) {
@@ -891,34 +1378,54 @@ void expression(int level) {
             // *++text = IMM;                                            // Inversion of inc/dec
             // *++text = (expr_type>PTR) ? sizeof(int) : sizeof(char);   //
             // *++text = (token=Inc) ? SUB : ADD;                        //
+            //
+            // an int or a pointer is incremented in place, and its original
+            // value is not restored when the value of the expression is unused
+            //
+            // <address>
+            // INC <+-size>
+            // PUSH                 |
+            // IMM <size>           | unless unused
+            // SUB/ADD              |
 
             if (*text==LI) {
-                *text = PUSH;
-                *++text = LI;
+                *text = INC;
+                *++text = (expr_type>PTR) ? sizeof(int) : sizeof(char);
+                if (token==Dec) {
+                    *text = -*text;
+                }
+                tmp = token;
+                match(token);
+                if (!unused || token!=';') {
+                    *++text = PUSH;
+                    *++text = IMM;
+                    *++text = (expr_type>PTR) ? sizeof(int) : sizeof(char);
+                    *++text = (tmp==Inc) ? SUB : ADD;
+                }
             } else if (*text==LC) {
                 *text = PUSH;
                 *++text = LC;
+                *++text = PUSH;
+                *++text = IMM;
+                *++text = sizeof(char);
+                *++text = (token==Inc) ? ADD : SUB;
+                *++text = SC;
+                *++text = PUSH;
+                *++text = IMM;
+                *++text = sizeof(char);
+                *++text = (token==Inc) ? SUB : ADD;
+                match(token);
             } else {
                 printf("%d: Bad value in increment\n", line);
                 exit(-1);
             }
 
-            *++text = PUSH;
-            *++text = IMM;
-            *++text = (expr_type>PTR) ? sizeof(int) :sizeof(char);
-            *++text = (token==Inc) ? ADD : SUB;
-            *++text = (expr_type==CHAR) ? SC : SI;
-            *++text = PUSH;
-            *++text = IMM;
-            *++text = (expr_type>PTR) ? sizeof(int) : sizeof(char);
-            *++text = (token==Inc) ? SUB : ADD;
-            match(token);
-
         } else if (token==Brak) {
             // array access var[xx]
             match(Brak);
             
             *++text = PUSH;
+            addr = text;
             expression(Assign);
             match(']');
 
@@ -927,13 +1434,13 @@ void expression(int level) {
                 *++text = PUSH;
                 *++text = IMM;
                 *++text = sizeof(int);
-                *++text = MUL;
+                emit_op(MUL, addr);
             } else if (tmp<PTR) {
                 printf("%d: Pointer type expected\n", line);
                 exit(-1);
             }
             expr_type = tmp - PTR;
-            *++text = ADD;
+            emit_op(ADD, start);
             *++text = (expr_type==CHAR) ? LC : LI;
 
         } else {
@@ -941,12 +1448,120 @@ void expression(int level) {
             exit(-1);
         }
     }
+    // the caller emits its own code after this expression, however deep the
+    // nesting was
+    reserve_text(64);
+}
+
+void jump_default() {
+    // jump to the default label of the innermost switch, or leave it
+    *++text = JMP;
+    if (switch_default) {
+        *++text = (int)switch_default;
+    } else {
+        *++text = (int)breaks;
+        breaks = text;
+    }
+}
+
+void emit_switch() {
+    // emit the jump table of the innermost switch, the value is in the register
+    // the cases are indexed directly if their values are dense enough
+    //
+    // ----- dense -----         ----- sparse -----
+    // PUSH                      JBIN <n>
+    // IMM <min>                 IMM <value 0>
+    // SUB                       JMP <case 0>
+    // JTAB <max - min + 1>      ...
+    // JMP <case min>            IMM <value n-1>
+    // JMP <case min + 1>        JMP <case n-1>
+    // ...                       JMP <default>
+    // JMP <default>
+    //
+    // or found by binary search in the values otherwise, see `find_case()`
+    int *c, n, i, j, value, addr, min, range;
+
+    c = cases + 2 * switch_cases;
+    n = num_cases - switch_cases;
+
+    // sort the cases by their values
+    i = 1;
+    while (i<n) {
+        value = c[2 * i];
+        addr = c[2 * i + 1];
+        j = i;
+        while (j>0 && c[2 * j - 2]>value) {
+            c[2 * j] = c[2 * j - 2];
+            c[2 * j + 1] = c[2 * j - 1];
+            j--;
+        }
+        c[2 * j] = value;
+        c[2 * j + 1] = addr;
+        if (j>0 && c[2 * j - 2]==value) {
+            printf("%d: Duplicate case value %d\n", line, value);
+            exit(-1);
+        }
+        i++;
+    }
+
+    if (n) {
+        min = c[0];
+        range = c[2 * n - 2] - min + 1;
+        if (range>0 && range<=2 * n + 4) {
+            reserve_text(2 * range + 64);
+            if (min) {
+                *++text = PUSH;
+                *++text = IMM;
+                *++text = min;
+                *++text = SUB;
+            }
+            *++text = JTAB;
+            *++text = range;
+            i = 0;
+            value = min;
+            while (value<min + range) {
+                if (c[2 * i]==value) {
+                    *++text = JMP;
+                    *++text = c[2 * i + 1];
+                    i++;
+                } else {
+                    jump_default();
+                }
+                value++;
+            }
+        } else {
+            reserve_text(4 * n + 64);
+            *++text = JBIN;
+            *++text = n;
+            i = 0;
+            while (i<n) {
+                *++text = IMM;
+                *++text = c[2 * i];
+                *++text = JMP;
+                *++text = c[2 * i + 1];
+                i++;
+            }
+        }
+    }
+    jump_default();
+}
+
+void condition() {
+    // the condition of if/while, `&&` and `||` at its top level jump to
+    // `jumps_true` and `jumps_false` instead of computing the value, and
+    // the value left in the register is the last one to test
+    jumps_true = jumps_false = 0;
+    branching = 1;
+    expression(Assign);
 }
 
 void statement() {
     // if statement and while statement will cause jump between two sections
     // we declare two pointer to `section1` and `section2`
     int *section1, *section2;
+    int *cond, *cond_end;  // code of the condition of while
+    int *outer_breaks, *outer_default, outer_cases;
+    reserve_text(64);
 
     if (token==If) {
         // if (...) <statement> [else <statement>]
@@ -961,50 +1576,150 @@ void statement() {
 
         match(If);
         match('(');
-        expression(Assign);  // parse condition
+        condition();
         match(')');
 
-        // emit code for if
+        // emit code for if, section2 is the chain of jumps to section1
         *++text = JZ;
-        section2 = ++text;
+        *++text = (int)jumps_false;
+        section2 = text;
+        patch(jumps_true, text + 1);
 
         statement();         // parse statement
         if (token==Else) {
             match(Else);
 
             // emit code for section2
-            *section2 = (int)(text + 3);
+            patch(section2, text + 3);
             *++text = JMP;
             section2 = ++text;
+            *section2 = 0;
 
             statement();
         }
 
-        *section2 = (int)(text + 1);
+        patch(section2, text + 1);
 
     } else if (token==While) {
-        //                    | section1:
+        // the condition is tested again at the bottom, so an iteration
+        // takes only one jump
+        //
         //    while (<cond>)  |            <cond>
         //                    |            JZ section2
-        //     <statement>    |            <statement>
-        //                    |            JMP section1
+        //     <statement>    | section1:
+        //                    |            <statement>
+        //                    |            <cond>
+        //                    |            JNZ section1
         //                    | section2:
 
         match(While);
 
-        section1 = text + 1;
-
         match('(');
-        expression(Assign);
+        cond = text;
+        condition();
         match(')');
+        cond_end = text;
 
+        // the false jumps go through the last test, so that the copy of
+        // the condition doesn't refer to the exit before it's known
+        patch(jumps_false, cond_end + 1);
         *++text = JZ;
         section2 = ++text;
+        section1 = text + 1;
+        patch(jumps_true, section1);
 
+        outer_breaks = breaks;
+        breaks = 0;
+        loops++;
         statement();
-        *++text = JMP;
+        loops--;
+        emit_copy(cond, cond_end);
+        *++text = JNZ;
         *++text = (int)section1;
         *section2 = (int)(text + 1);
+        patch(breaks, text + 1);
+        breaks = outer_breaks;
+
+    } else if (token==Switch) {
+        // the cases are labels in the statement, the jump table is emitted
+        // after the statement when all of them are known
+        //
+        //    switch (<expr>)  |            <expr>
+        //                     |            JMP section1
+        //      <statement>    |            <statement>
+        //                     |            JMP section2
+        //                     | section1:
+        //                     |            <jump table>
+        //                     | section2:
+
+        match(Switch);
+        match('(');
+        expression(Assign);
+        match(')');
+        *++text = JMP;
+        section1 = ++text;
+
+        outer_breaks = breaks;
+        outer_cases = switch_cases;
+        outer_default = switch_default;
+        breaks = 0;
+        switch_cases = num_cases;
+        switch_default = 0;
+        loops++;
+        switches++;
+        statement();
+        loops--;
+        switches--;
+
+        *++text = JMP;
+        *++text = (int)breaks;
+        breaks = text;
+        *section1 = (int)(text + 1);
+        emit_switch();
+        patch(breaks, text + 1);
+
+        num_cases = switch_cases;
+        breaks = outer_breaks;
+        switch_cases = outer_cases;
+        switch_default = outer_default;
+
+    } else if (token==Case) {
+        // case <constant>:
+        match(Case);
+        section1 = text;
+        expression(Cond);
+        if (!switches || !is_const(section1)) {
+            printf("%d: Bad case\n", line);
+            exit(-1);
+        }
+        text = section1;
+        grow(case_pool, (int)(cases + 2 * num_cases + 2));
+        cases[2 * num_cases] = text[2];
+        cases[2 * num_cases + 1] = (int)(text + 1);
+        num_cases++;
+        match(':');
+
+    } else if (token==Default) {
+        // default:
+        match(Default);
+        if (!switches || switch_default) {
+            printf("%d: Bad default\n", line);
+            exit(-1);
+        }
+        switch_default = text + 1;
+        match(':');
+
+    } else if (token==Break) {
+        // break;
+        match(Break);
+        if (!loops) {
+            printf("%d: break outside of loop or switch\n", line);
+            exit(-1);
+        }
+        *++text = JMP;
+        *++text = (int)breaks;
+        breaks = text;
+        match(';');
     
     } else if (token==Return) {
         // return [ expression ]
@@ -1039,10 +1754,13 @@ void statement() {
     } else {
         // Assignment:     `a = b;`
         // Function call:  `func_name();`
+        // the value of the expression is not used
 
+        discarded = 1;
         expression(Assign);
         match(';');
     }
+    reserve_text(64);   // and after this statement
 }
 
 void function_body() {
@@ -1090,6 +1808,7 @@ void function_body() {
     }
 
     // save the stack size for local variables
+    reserve_text(64);
     *++text = ENT;
     *++text = pos_local - index_of_bp;
 
@@ -1099,6 +1818,7 @@ void function_body() {
     }
 
     // emit code for leaving the sub function
+    reserve_text(64);
     *++text = LEV;
 }
 
@@ -1151,10 +1871,27 @@ void function_parameter() {
 void function_declaration() {
     // type func_name (...) { ... }
 
+    in_function = 1;
     match('(');
     function_parameter();
     match(')');
 
+    if (token==';') {
+        // prototype: type func_name (...);
+        // the function is defined later or in another translation unit
+        curr_id = symbols;
+        while (curr_id[Token]) {
+            if (curr_id[Class]==Loc) {
+                curr_id[Class] = curr_id[BClass];
+                curr_id[Type]  = curr_id[BType];
+                curr_id[Value] = curr_id[BValue];
+            }
+            curr_id = curr_id + IdSize;
+        }
+        in_function = 0;
+        return ;
+    }
+
     match('{');
     function_body();
     // match('}');
@@ -1175,6 +1912,7 @@ void function_declaration() {
         }
         curr_id = curr_id + IdSize;
     }
+    in_function = 0;
 }
 
 void enum_declaration() {
@@ -1196,6 +1934,9 @@ void enum_declaration() {
             i = token_val;
             next();
         }
+        if (include_depth) {
+            depend(curr_id);
+        }
         curr_id[Class] = Num;
         curr_id[Type] = INT;
         curr_id[Value] = i++;
@@ -1214,6 +1955,7 @@ void global_declaration() {
 
     int type;   // the actual type of variable;
     int i;
+    int *id;
 
     basetype = INT;
 
@@ -1256,24 +1998,41 @@ void global_declaration() {
             printf("%d: Bad global declaration\n", line);
             exit(-1);
         }
-        if (curr_id[Class]) {
+        match(Id);
+        id = curr_id;
+
+        // functions may be declared by prototypes more than once
+        if (id[Class] && (id[Class]!=Fun || token!='(')) {
             printf("%d: Duplicate global declaration\n", line);
             exit(-1);
         }
-        match(Id);
-        curr_id[Type] = type;
+        id[Type] = type;
+        if (include_depth) {
+            depend(id);
+        }
 
-        if (token='(') {
+        if (token=='(') {
             // if '(' comes after the variable name
             // it is defined as a function
-            curr_id[Class] = Fun;
-            curr_id[Value] = (int)(text + 1); // the memory address of the function
+            i = id[Value];
+            id[Class] = Fun;
+            id[Value] = (int)(text + 1); // the memory address of the function
             function_declaration();
+
+            if (token==';') {
+                id[Value] = i;           // prototype, keep the definition if any
+            } else if (i) {
+                printf("%d: Duplicate function definition\n", line);
+                exit(-1);
+            } else if (opt_level) {
+                optimize(id);
+            }
         } else {
             // global variable otherwise
-            curr_id[Class] = Glo;
-            curr_id[Value] = (int)data;
+            id[Class] = Glo;
+            id[Value] = (int)data;
             data = data + sizeof(int);
+            grow(data_pool, (int)data);
         }
 
         if (token==',') {
@@ -1290,167 +2049,3648 @@ void program() {
     }
 }
 
-int eval() {
-    int op, *tmp;
-    while (1) {
-        op = *pc++;                                                            // Get next operation
-
-        if      (op==IMM)  { gpr = *pc++; }                                    // load IMMediate
-        else if (op==LC)   { gpr = *(char *)gpr; }                             // Load Character
-        else if (op==LI)   { gpr = *(int *)gpr; }                              // Load Integer
-        else if (op==SC)   { *(char *)*sp++ = gpr; }                           // Save Character
-        else if (op==SI)   { *(int *)*sp++ = gpr; }                            // Save Integer
-        else if (op==PUSH) { *--sp = gpr; }                                    // PUSH value onto the stack
-
-        // jump (branch)
-        else if (op==JMP)  { pc = (int *)*pc; }                                // JuMP to the address
-        else if (op==JZ)   { pc = gpr ? pc + 1 : (int *)*pc; }                 // Jump if (gpr==0)
-        else if (op==JNZ)  { pc = gpr ? (int *)*pc : pc + 1; }                 // Jump if Not (gpr==0)
-
-        // function call
-        else if (op==CALL) { *--sp = (int)(pc + 1); pc = (int *)*pc; }         // CALL subroutine
-        // else if (op==RET)  { pc = (int *)*sp++; }                           // RET is not provided for simplicity
-        else if (op==ENT)  { *--sp = (int)bp; bp = sp; sp = sp - *pc++; }      // ENTer, to make new stack frame
-        else if (op==ADJ)  { sp = sp + *pc++; }                                // pop all args from frame
-        else if (op==LEV)  { sp = bp; bp = (int *)*sp++; pc = (int *)*sp++; }  // LEaVe subroutine, which is 'pop and return'
-        else if (op==LEA)  { gpr = (int)(bp + *pc++); }                        // Load Effective Address, load the args
-
-        // Arithmetic operations
-        else if (op==OR)   { gpr = *sp++ |  gpr; }
-        else if (op==XOR)  { gpr = *sp++ ^  gpr; }
-        else if (op==AND)  { gpr = *sp++ &  gpr; }
-        else if (op==EQ)   { gpr = *sp++ == gpr; }
-        else if (op==NE)   { gpr = *sp++ != gpr; }
-        else if (op==LT)   { gpr = *sp++ <  gpr; }
-        else if (op==LE)   { gpr = *sp++ <= gpr; }
-        else if (op==GT)   { gpr = *sp++ >  gpr; }
-        else if (op==GE)   { gpr = *sp++ >= gpr; }
-        else if (op==SHL)  { gpr = *sp++ << gpr; }
-        else if (op==SHR)  { gpr = *sp++ >> gpr; }
-        else if (op==ADD)  { gpr = *sp++ +  gpr; }
-        else if (op==SUB)  { gpr = *sp++ -  gpr; }
-        else if (op==MUL)  { gpr = *sp++ *  gpr; }
-        else if (op==DIV)  { gpr = *sp++ /  gpr; }
-        else if (op==MOD)  { gpr = *sp++ %  gpr; }
-
-        // Built-in Instructions
-        else if (op==EXIT) { printf("exit(%d)", *sp); return *sp; }
-        else if (op==OPEN) { gpr = open((char *)sp[1], sp[0]); }
-        else if (op==CLOS) { gpr = close(*sp); }
-        else if (op==READ) { gpr = read(sp[2], (char *)sp[1], *sp); }
-        else if (op==PRTF) { tmp = sp + pc[1]; gpr = printf((char *)tmp[-1], tmp[-2], tmp[-3], tmp[-4], tmp[-5], tmp[-6]); }
-        else if (op==MALC) { gpr = (int)malloc(*sp); }
-        else if (op==MSET) { gpr = (int)memset((char *)sp[2], sp[1], *sp); }
-        else if (op==MCMP) { gpr = memcmp((char *)sp[2], (char *)sp[1], *sp); }
-        else {
-            printf("Unknown instruction: %d\n", op);
-            return -1;
-        }
+int id_length(char *name) {
+    char *p;
+    p = name;
+    while ((*p>='a' && *p<='z') || (*p>='A' && *p<='Z') || (*p>='0' && *p<='9') || (*p=='_')) {
+        p++;
     }
-
-    return 0;
+    return p - name;
 }
 
-int main(int argc, char **argv)
-{
-    int i, fd;
-    int *tmp;
-
-    --argc;
-    ++argv;
-    poolsz = 256 * 1024;  // arbitrary size
-    line = 1;
+int *insn(int i) {
+    return insns + i * InsSize;
+}
 
-    if ((fd = open(*argv, 0)) < 0) {
-        printf("Could not open(%s)\n", *argv);
-        return -1;
+int live(int i) {
+    // index of the first instruction from `i` which is not removed
+    while (i<num_insns && insns[i * InsSize + IOp]==NOP) {
+        i++;
     }
-
-    // allocate memory for virtual machine
-    if (!(text = old_text = malloc(poolsz))) {
-        printf("Could not malloc(%d) for text area\n", poolsz);
-        return -1;
+    if (i>num_insns) {
+        return num_insns;
     }
+    return i;
+}
 
-    if (!(data = malloc(poolsz))) {
-        printf("Could not malloc(%d) for data area\n", poolsz);
-        return -1;
+void set_target(int i, int t) {
+    // make the jump at `i` go to instruction `t`, -1 for nowhere
+    int *ins;
+    ins = insn(i);
+    insns[live(ins[IArg]) * InsSize + ILabel]--;
+    ins[IArg] = t;
+    if (t>=0) {
+        insns[t * InsSize + ILabel]++;
     }
+}
 
-    if (!(stack = malloc(poolsz))) {
-        printf("Could not malloc(%d) for stack area\n", poolsz);
-        return -1;
+void drop(int i) {
+    // remove an instruction, jumps to it go to the next one instead
+    int *ins;
+    ins = insn(i);
+    if (is_jump(ins[IOp])) {
+        set_target(i, -1);
     }
+    ins[IOp] = NOP;
+    if (ins[ILabel]) {
+        insns[live(i) * InsSize + ILabel] = insns[live(i) * InsSize + ILabel] + ins[ILabel];
+        ins[ILabel] = 0;
+    }
+}
 
-    if (!(symbols = malloc(poolsz))) {
-        printf ("Could not malloc(%d) for symbol table\n", poolsz);
+int stack_pops(int *ins) {
+    // number of words an instruction pops off the stack, -1 for PUSH
+    int op;
+    op = ins[IOp];
+    if (op==PUSH) {
         return -1;
+    } else if (op==ADJ) {
+        return ins[IArg];
+    } else if (op==SI || op==SC || (op>=OR && op<=MOD)) {
+        return 1;
     }
+    return 0;
+}
 
-    memset(text, 0, poolsz);
-    memset(data, 0, poolsz);
-    memset(stack, 0, poolsz);
-    memset(symbols, 0, poolsz);
-
-    bp = sp = (int *)((int)stack + poolsz);
-    gpr = 0;
-
-    // keywords with special meaning
-    // which cannot be considered as a normal identifier
-    //   => one must add these special keywords to
-    //      symbol table before calling `next()`
-    src = "char else enum if int return sizeof while "
-          "open read close printf malloc memset memcmp exit void main";
-
-    // add keywords to symbol table
-    i = Char;
-    while (i<=While) {
-        // Char, Else, Enum, If, Int, Return, Sizeof, While, 
-        next();
-        curr_id[Token] = i++;
+int pusher(int i) {
+    // index of the PUSH of the word which instruction `i` pops first,
+    // -1 if it isn't in the same function
+    int need;
+    need = 1;
+    while (--i>0) {
+        if (insns[i * InsSize + IOp]==PUSH) {
+            if (!--need) {
+                return i;
+            }
+        } else {
+            need = need + stack_pops(insn(i));
+        }
     }
+    return -1;
+}
 
-    // add library to symbol table
-    i = OPEN;
-    while (i<=EXIT) {
-        // OPEN, READ, CLOS, PRTF, MALC, MSET, MCMP, EXIT
-        next();
-        curr_id[Class] = Sys;
-        curr_id[Type]  = INT;
-        curr_id[Value] = i++;
+int popper(int i) {
+    // index of the instruction which pops the word pushed by instruction `i`
+    int depth;
+    depth = 0;
+    while (++i<num_insns) {
+        depth = depth - stack_pops(insn(i));
+        if (depth<0) {
+            return i;
+        }
     }
+    return -1;
+}
 
-    next(); curr_id[Token] = Char;  // handle void type
-    next(); idmain = curr_id;       // keep track of main
+int *add_insn(int op, int arg, int tag) {
+    // append an instruction to the decoded ones
+    int *ins;
+    grow(opt_pool, (int)(insns + (num_insns + 2) * InsSize));
+    ins = insn(num_insns++);
+    ins[IOp] = op;
+    ins[IArg] = arg;
+    ins[ITag] = tag;
+    ins[ILabel] = ins[IFixed] = ins[IEscape] = ins[ISave] = 0;
+    return ins;
+}
 
-    if (!(src = old_src = malloc(poolsz))) {
-        printf("Could not malloc(%d) for source area\n", poolsz);
-        return -1;
+int inlinable(int *f, int *start) {
+    // whether a call to `f` from the function at `start` can be replaced by
+    // the code of `f`: a short function without locals, calls or branches,
+    // which only loads its arguments
+    int n;
+    if (!f || f>start || f[0]!=ENT || f[1]>0) {
+        return 0;
+    }
+    f = f + 2;
+    n = 0;
+    while (*f!=LEV && *f!=RET) {
+        if (++n>INLINE_MAX || *f==CALL || is_jump(*f) || *f==JTAB || *f==JBIN || *f==ENT
+            || (*f==LEA && (f[1]<2 || f[2]!=LI))) {
+            return 0;
+        }
+        f = f + 1 + has_arg(*f);
     }
+    return 1;
+}
 
-    // read the source file
-    if ((i = read(fd, src, poolsz - 1)) <= 0) {
-        printf("read() returned %d\n", i);
-        return -1;
+void inline_call(int *f) {
+    // decode the code of `f` in place of a call to it, the arguments are
+    // still on the stack, and loaded relative to the stack pointer
+    //
+    // ----- origin -----       ----- inlined -----
+    // <arg 1>                  <arg 1>
+    // PUSH                     PUSH
+    // <arg 2>                  <arg 2>
+    // PUSH                     PUSH
+    // CALL f                   <code of f>
+    // ADJ 2                    ADJ 2
+    //
+    // and in the code of f, the arguments are loaded by `LSP`
+    //
+    // ----- origin -----       ----- inlined -----
+    // LEA <offset>             LSP <offset - 2 + words pushed so far>
+    // LI
+    //
+    // a function without frame loads them by `LSP` already, past its
+    // return address
+    int depth, frameless, *ins;
+    frameless = f[1]<0;
+    f = f + 2;
+    depth = 0;
+    while (*f!=LEV && *f!=RET) {
+        if (*f==LEA) {
+            add_insn(LSP, f[1] - 2 + depth, 0);
+            f = f + 3;
+        } else if (*f==LSP && frameless && f[1]>=depth) {
+            add_insn(LSP, f[1] - 1, 0);
+            f = f + 2;
+        } else {
+            ins = add_insn(*f, 0, 0);
+            if (has_arg(*f)) {
+                ins[IArg] = f[1];
+                ins[ITag] = tags[f + 1 - old_text];
+            }
+            depth = depth - stack_pops(ins);
+            f = f + 1 + has_arg(*f);
+        }
     }
+}
 
-    src[i] = 0; // 0 as '\0' representing a EOF character
-    close(fd);
+int decode(int *start) {
+    // decode the function from `start` to the end of text into `insns`,
+    // with the calls of small functions inlined,
+    // returns the number of instructions before inlining
+    int *p, *ins, i, n, fixed;
+
+    n = text - start;
+    insn_at = (int *)opt_pool[PBase];
+    insns = insn_at + n + 1;
+    grow(opt_pool, (int)insns);
+
+    p = start;
+    num_insns = 0;
+    fixed = 0;
+    n = 0;
+    while (p<text) {
+        n++;
+        insn_at[++p - start] = num_insns;
+        if (*p==CALL && inlinable((int *)p[1], start)) {
+            inline_call((int *)*++p);
+        } else {
+            ins = add_insn(*p, 0, 0);
+            ins[IFixed] = fixed>0;
+            fixed--;
+            if (has_arg(*p)) {
+                ins[IArg] = *++p;
+                ins[ITag] = tags[p - old_text];
+            }
+            if (ins[IOp]==JTAB) {
+                fixed = ins[IArg] + 1;
+            } else if (ins[IOp]==JBIN) {
+                fixed = 2 * ins[IArg] + 1;
+            }
+        }
+    }
+    add_insn(END, 0, 0);
+    num_insns--;
+
+    // jumps refer to instructions by their indexes
+    i = 0;
+    while (i<num_insns) {
+        ins = insn(i++);
+        if (is_jump(ins[IOp])) {
+            ins[IArg] = insn_at[(int *)ins[IArg] - start];
+            insns[ins[IArg] * InsSize + ILabel]++;
+        }
+    }
+    return n;
+}
+
+int encode(int *start) {
+    // encode the instructions back to the text from `start`,
+    // returns the number of instructions left
+    int *p, *ins, *end, i, n;
+
+    // removed instructions take the address of the next one
+    p = start + 1;
+    i = 0;
+    while (i<=num_insns) {
+        ins = insn(i++);
+        ins[IAddr] = (int)p;
+        if (ins[IOp]!=NOP) {
+            p = p + 1 + has_arg(ins[IOp]);
+        }
+    }
+
+    end = text;
+    text = start;
+    reserve_text(p - start);   // inlined calls may make the function longer
+    i = n = 0;
+    while (i<num_insns) {
+        ins = insn(i++);
+        if (ins[IOp]!=NOP) {
+            n++;
+            *++text = ins[IOp];
+            tags[text - old_text] = 0;
+            if (is_jump(ins[IOp])) {
+                *++text = insns[ins[IArg] * InsSize + IAddr];
+                tags[text - old_text] = 0;
+            } else if (has_arg(ins[IOp])) {
+                *++text = ins[IArg];
+                tags[text - old_text] = ins[ITag];
+            }
+        }
+    }
+
+    // clear the words which are freed
+    p = text;
+    while (p<end) {
+        *++p = 0;
+        tags[p - old_text] = 0;
+    }
+    return n;
+}
+
+int same_operand(int *a, int *b) {
+    return a[IOp]==b[IOp] && a[IArg]==b[IArg] && a[ITag]==b[ITag];
+}
+
+int peephole() {
+    // rewrite short sequences of instructions, returns whether anything changed
+    //
+    // ----- origin -----       ----- rewritten -----
+    // IMM <a>                  IMM <a op b>
+    // PUSH
+    // IMM <b>
+    // <op>
+    //
+    // PUSH                     (nothing)               x + 0, x * 1, ...
+    // IMM <0 or 1>
+    // <op>
+    //
+    // PUSH                     NEG                     x * -1
+    // IMM -1
+    // MUL
+    //
+    // PUSH                     PUSH                    x * 2^k
+    // IMM <2^k>                IMM <k>
+    // MUL                      SHL
+    //
+    // IMM -1                   <x>                     -x
+    // PUSH                     NEG
+    // <x>
+    // MUL
+    //
+    // PUSH                     PUSH                    x + a + b
+    // IMM <a>                  IMM <a + b>
+    // ADD                      ADD
+    // PUSH
+    // IMM <b>
+    // ADD
+    //
+    // LEA <n>                  LEA <n>                 the stored value is
+    // PUSH                     PUSH                    still in the register
+    // ...                      ...
+    // SI                       SI
+    // LEA <n>
+    // LI
+    //
+    // PUSH                     PUSH                    so is the argument
+    // LSP 0                                            just pushed
+    //
+    // ADJ 0                    (nothing)               unless after CALL
+    int i, j1, j2, j3, j4, j5, k, op, changed, *a, *b, *c, *d, *e, *f;
+
+    changed = 0;
+    i = live(0);
+    while (i<num_insns) {
+        j1 = live(i + 1);  j2 = live(j1 + 1); j3 = live(j2 + 1);
+        a = insn(i); b = insn(j1); c = insn(j2); d = insn(j3);
+        op = c[IOp];
+        k = b[IArg];
+
+        if (a[IOp]==IMM && !a[ITag] && b[IOp]==PUSH && c[IOp]==IMM && !c[ITag]
+            && d[IOp]>=OR && d[IOp]<=MOD && !b[ILabel] && !c[ILabel] && !d[ILabel]
+            && foldable(d[IOp], a[IArg], c[IArg])) {
+            // constant operands
+            a[IArg] = fold(d[IOp], a[IArg], c[IArg]);
+            drop(j1); drop(j2); drop(j3);
+            changed = 1;
+
+        } else if (a[IOp]==PUSH && b[IOp]==LSP && !b[IArg] && !b[ILabel]) {
+            drop(j1);
+            changed = 1;
+
+        } else if (b[IOp]==ADJ && !k && a[IOp]!=CALL) {
+            // left by an inlined call without arguments
+            drop(j1);
+            changed = 1;
+
+        } else if (a[IOp]==PUSH && b[IOp]==IMM && !b[ITag] && !b[ILabel] && !c[ILabel]) {
+            j4 = live(j3 + 1); j5 = live(j4 + 1);
+            e = insn(j4); f = insn(j5);
+
+            if ((!k && (op==ADD || op==SUB || op==OR || op==XOR || op==SHL || op==SHR))
+                || (k==1 && (op==MUL || op==DIV))) {
+                // the left operand is unchanged
+                drop(i); drop(j1); drop(j2);
+                changed = 1;
+            } else if (!k && (op==MUL || op==AND)) {
+                // the result is 0, the left operand is evaluated already
+                drop(i); drop(j2);
+                changed = 1;
+            } else if (k==-1 && op==MUL) {
+                drop(i); drop(j1);
+                c[IOp] = NEG;
+                changed = 1;
+            } else if (power_of_two(k)>0 && op==MUL) {
+                b[IArg] = power_of_two(k);
+                c[IOp] = SHL;
+                changed = 1;
+            } else if ((op==ADD || op==SUB) && d[IOp]==PUSH && e[IOp]==IMM && !e[ITag]
+                && (f[IOp]==ADD || f[IOp]==SUB) && !d[ILabel] && !e[ILabel] && !f[ILabel]) {
+                // both constants are added to the same operand
+                if (op==SUB) {
+                    k = -k;
+                }
+                if (f[IOp]==ADD) {
+                    b[IArg] = k + e[IArg];
+                } else {
+                    b[IArg] = k - e[IArg];
+                }
+                c[IOp] = ADD;
+                drop(j3); drop(j4); drop(j5);
+                changed = 1;
+            }
+
+        } else if (a[IOp]==IMM && !a[ITag] && a[IArg]==-1 && b[IOp]==PUSH && !b[ILabel]
+            && (j3 = popper(j1))>0 && insn(j3)[IOp]==MUL) {
+            // negation
+            drop(i); drop(j1);
+            insn(j3)[IOp] = NEG;
+            changed = 1;
+
+        } else if (a[IOp]==SI && (b[IOp]==LEA || b[IOp]==IMM) && c[IOp]==LI
+            && !b[ILabel] && !c[ILabel] && (j3 = pusher(i))>0 && !insn(j3)[ILabel]) {
+            // reload of the value just stored
+            j4 = j3 - 1;
+            while (j4>0 && insn(j4)[IOp]==NOP) {
+                j4--;
+            }
+            if (same_operand(insn(j4), b)) {
+                drop(j1); drop(j2);
+                changed = 1;
+            }
+        }
+        i = live(i + 1);
+    }
+    return changed;
+}
+
+int destination(int i) {
+    // the instruction where the jump at `i` finally goes, following the
+    // jumps which are certainly taken or not taken from there
+    int op, t, n, next;
+    op = insn(i)[IOp];
+    t = live(insn(i)[IArg]);
+    n = 0;
+    while (n++<num_insns) {
+        next = insn(t)[IOp];
+        if (next==JMP || (next==op && op!=JMP)) {
+            // the register is unchanged, so is the result of the test
+            t = live(insn(t)[IArg]);
+        } else if ((op==JZ && next==JNZ) || (op==JNZ && next==JZ)) {
+            t = live(t + 1);
+        } else {
+            return t;
+        }
+    }
+    return t;    // a loop of jumps
+}
+
+int thread_jumps() {
+    // resolve jumps to their final destinations, returns whether anything changed
+    //
+    // ----- origin -----       ----- rewritten -----
+    // JMP L1                   JMP L2
+    // ...                      ...
+    // L1: JMP L2               L1: JMP L2
+    //
+    // JMP L1                   (nothing)
+    // L1:                      L1:
+    //
+    // JMP L1                   LEV
+    // ...                      ...
+    // L1: LEV                  L1: LEV
+    //
+    // JZ L1                    JNZ L2
+    // JMP L2                   L1:
+    // L1:
+    //
+    // IMM 0                    IMM 0
+    // JZ L1                    JMP L1
+    int i, j, t, op, changed, *ins, *prev;
+
+    changed = 0;
+    prev = insn(num_insns);
+    i = live(0);
+    while (i<num_insns) {
+        ins = insn(i);
+        op = ins[IOp];
+        j = live(i + 1);
+
+        if (op!=JMP && is_jump(op) && !ins[ILabel] && prev[IOp]==IMM && !prev[ITag]) {
+            // the test has a constant result
+            if (!prev[IArg]==(op==JZ)) {
+                ins[IOp] = JMP;
+            } else {
+                drop(i);
+            }
+            changed = 1;
+
+        } else if (is_jump(op)) {
+            t = destination(i);
+            if (t!=live(ins[IArg])) {
+                set_target(i, t);
+                changed = 1;
+            }
+
+            if (ins[IFixed]) {
+                // jump tables keep their layout
+            } else if (t==j) {
+                drop(i);
+                changed = 1;
+            } else if (op==JMP && insn(t)[IOp]==LEV) {
+                set_target(i, -1);
+                ins[IOp] = LEV;
+                ins[IArg] = 0;
+                changed = 1;
+            } else if (op!=JMP && insn(j)[IOp]==JMP && !insn(j)[ILabel] && t==live(j + 1)) {
+                // branch around an unconditional jump
+                if (op==JZ) {
+                    ins[IOp] = JNZ;
+                } else {
+                    ins[IOp] = JZ;
+                }
+                set_target(i, live(insn(j)[IArg]));
+                drop(j);
+                changed = 1;
+            }
+        }
+
+        if (ins[IOp]!=NOP) {
+            prev = ins;
+        }
+        i = live(i + 1);
+    }
+    return changed;
+}
+
+int live_before(int i) {
+    // index of the last instruction before `i` which is not removed, -1 if none
+    while (--i>=0 && insns[i * InsSize + IOp]==NOP) {
+        ;
+    }
+    return i;
+}
+
+void insert_insns(int at, int n) {
+    // make room for `n` instructions before instruction `at`
+    int i, *ins;
+    grow(opt_pool, (int)(insns + (num_insns + n + 2) * InsSize));
+    i = (num_insns + 1) * InsSize;
+    while (i-->at * InsSize) {
+        insns[i + n * InsSize] = insns[i];
+    }
+    num_insns = num_insns + n;
+
+    i = 0;
+    while (i<=num_insns) {
+        ins = insn(i);
+        if (i>=at && i<at + n) {
+            ins[IOp] = NOP;
+            ins[IArg] = ins[ITag] = ins[ILabel] = ins[IFixed] = ins[IEscape] = ins[ISave] = 0;
+        } else if (is_jump(ins[IOp]) && ins[IArg]>=at) {
+            ins[IArg] = ins[IArg] + n;
+        }
+        i++;
+    }
+}
+
+void save_values() {
+    // insert the code which saves the values of the expressions marked by
+    // `ISave` in one move of the instructions, jumps to an expression go to
+    // the new LEA before it
+    //
+    // ----- origin -----       ----- rewritten -----
+    //                          LEA <save>
+    //                          PUSH
+    // <expr>                   <expr>
+    //                          SI
+    int i, k, n, *ins, *to;
+
+    // where the jumps to every instruction go from now on
+    n = 0;
+    i = 0;
+    while (i<=num_insns) {
+        ins = insn(i);
+        ins[IAddr] = i + n;
+        if (ins[ISave]<0) {
+            n = n + 2;
+        } else if (ins[ISave]>0) {
+            n++;
+        }
+        i++;
+    }
+    i = 0;
+    while (i<num_insns) {
+        ins = insn(i++);
+        if (is_jump(ins[IOp])) {
+            ins[IArg] = insn(ins[IArg])[IAddr];
+        }
+    }
+
+    // move the instructions from the last one, and fill in the new ones
+    grow(opt_pool, (int)(insns + (num_insns + n + 2) * InsSize));
+    i = num_insns;
+    while (i>=0) {
+        ins = insn(i);
+        to = insn(ins[IAddr] + (ins[ISave]<0) * 2);
+        k = InsSize;
+        while (k--) {
+            to[k] = ins[k];
+        }
+        if (to[ISave]<0) {
+            ins = to - 2 * InsSize;
+            k = 2 * InsSize;
+            while (k--) {
+                ins[k] = 0;
+            }
+            ins[IOp] = LEA;
+            ins[IArg] = to[ISave];
+            ins[ILabel] = to[ILabel];
+            ins[InsSize + IOp] = PUSH;
+            to[ILabel] = 0;
+        } else if (to[ISave]>0) {
+            ins = to + InsSize;
+            k = InsSize;
+            while (k--) {
+                ins[k] = 0;
+            }
+            ins[IOp] = SI;
+        }
+        to[ISave] = 0;
+        i--;
+    }
+    num_insns = num_insns + n;
+}
+
+int store_target(int i) {
+    // index of the `LEA` or `IMM` which loads the address stored to by the
+    // SI/SC/INC at `i`, -1 if it's computed otherwise
+    int j;
+    j = (insn(i)[IOp]==INC) ? i : pusher(i);
+    if (j<0 || insn(j)[ILabel]) {
+        return -1;
+    }
+    j = live_before(j);
+    if (j<0 || (insn(j)[IOp]!=LEA && insn(j)[IOp]!=IMM)) {
+        return -1;
+    }
+    return j;
+}
+
+int address_escapes(int i) {
+    // whether the address of the local loaded by the LEA at `i` is used other
+    // than for loading or storing it directly, so that it may be changed
+    // through a pointer
+    int j, op;
+    j = live(i + 1);
+    op = insn(j)[IOp];
+    if (op==PUSH) {
+        j = popper(j);
+        return j<0 || (insn(j)[IOp]!=SI && insn(j)[IOp]!=SC) || store_target(j)!=i;
+    } else if (op==INC) {
+        return store_target(j)!=i;
+    }
+    return op!=LI && op!=LC;
+}
+
+void find_escapes() {
+    // the variables of the frame, and whether their addresses are not taken,
+    // in `var_tracked`, and in `IEscape` of every LEA, in one sweep
+    int i, last, *ins;
+    first_var = last = 0;
+    i = 0;
+    while (i<num_insns) {
+        if (insn(i)[IOp]==LEA) {
+            if (insn(i)[IArg]<first_var) {
+                first_var = insn(i)[IArg];
+            }
+            if (insn(i)[IArg]>last) {
+                last = insn(i)[IArg];
+            }
+        }
+        i++;
+    }
+    num_vars = last - first_var + 1;
+    var_tracked = insns + (num_insns + 2) * InsSize;
+    grow(opt_pool, (int)(var_tracked + num_vars));
+    i = 0;
+    while (i<num_vars) {
+        var_tracked[i] = first_var + i!=0 && first_var + i!=1;
+        i++;
+    }
+    i = 0;
+    while (i<num_insns) {
+        if (insn(i)[IOp]==LEA && address_escapes(i)) {
+            var_tracked[insn(i)[IArg] - first_var] = 0;
+        }
+        i++;
+    }
+    i = 0;
+    while (i<num_insns) {
+        ins = insn(i++);
+        if (ins[IOp]==LEA) {
+            ins[IEscape] = !var_tracked[ins[IArg] - first_var];
+        }
+    }
+}
+
+int global_loads(int s, int e) {
+    // whether the expression from `s` to `e` loads global variables, -1 if it
+    // loads a local whose address escapes, see `find_escapes()`
+    int *var, globals;
+    globals = 0;
+    while (s<=e) {
+        if (insn(s)[IOp]==LI || insn(s)[IOp]==LC) {
+            var = insn(live_before(s));
+            if (var[IOp]==IMM) {
+                globals = 1;
+            } else if (var[IEscape]) {
+                return -1;
+            }
+        }
+        s = live(s + 1);
+    }
+    return globals;
+}
+
+int changes(int i, int s, int e, int globals) {
+    // whether instruction `i` may change the value of the expression from `s`
+    // to `e`: it stores to one of its variables, or, if `globals` is set, it
+    // may store to any global variable by a call or through a pointer
+    int j, op;
+    op = insn(i)[IOp];
+    if (op==CALL || (op>=OPEN && op<=EXIT)) {
+        return globals;
+    } else if (op!=SI && op!=SC && op!=INC) {
+        return 0;
+    } else if ((j = store_target(i))<0) {
+        return globals;
+    }
+    while (s<=e) {
+        if ((insn(s)[IOp]==LI || insn(s)[IOp]==LC) && same_operand(insn(live_before(s)), insn(j))) {
+            return 1;
+        }
+        s = live(s + 1);
+    }
+    return 0;
+}
+
+int expr_start(int e, int from) {
+    // start of the expression without side effects which ends at instruction
+    // `e`, and doesn't begin before `from`, -1 if there isn't one
+    int op, r, p;
+    if (e<from) {
+        return -1;
+    }
+    op = insn(e)[IOp];
+    if (op==IMM || op==LEA) {
+        // constants, and addresses of variables
+        return e;
+    } else if (op==LI || op==LC) {
+        // variables
+        p = live_before(e);
+        if (p>=from && (insn(p)[IOp]==LEA || insn(p)[IOp]==IMM)) {
+            return p;
+        }
+    } else if (op==NEG) {
+        return expr_start(live_before(e), from);
+    } else if (op>=OR && op<=MUL) {
+        // division is left alone, it may trap
+        r = expr_start(live_before(e), from);
+        if (r>=0) {
+            p = live_before(r);
+            if (p>=from && insn(p)[IOp]==PUSH) {
+                return expr_start(live_before(p), from);
+            }
+        }
+    }
+    return -1;
+}
+
+int loop_stores(int head, int tail) {
+    // find the variables stored to in the loop from `head` to `tail`: the
+    // locals are marked in the words after the instructions, the stores to
+    // globals follow them, returns whether the loop may store to any global
+    // variable, by calls or through pointers
+    int i, j, n, op, clobbered, *stores, *globals;
+    stores = insns + (num_insns + 2) * InsSize;
+    globals = stores + num_vars;
+    grow(opt_pool, (int)(globals + tail - head + 2));
+    i = 0;
+    while (i<num_vars) {
+        stores[i++] = 0;
+    }
+    n = clobbered = 0;
+    i = head;
+    while (i<=tail) {
+        op = insn(i)[IOp];
+        if (op==CALL || (op>=OPEN && op<=EXIT)) {
+            clobbered = 1;
+        } else if (op==SI || op==SC || op==INC) {
+            if ((j = store_target(i))<0) {
+                clobbered = 1;
+            } else if (insn(j)[IOp]==IMM) {
+                globals[++n] = j;
+            } else if (insn(j)[IArg]>=first_var && insn(j)[IArg]<first_var + num_vars) {
+                stores[insn(j)[IArg] - first_var] = 1;
+            }
+        }
+        i++;
+    }
+    globals[0] = n;
+    return clobbered;
+}
+
+int invariant(int s, int e, int clobbered) {
+    // whether the variables loaded by the expression from `s` to `e` are not
+    // stored to in the loop last seen by `loop_stores()`, where `clobbered`
+    // tells whether it may store to any global variable
+    int i, *var, *stores, *globals;
+    stores = insns + (num_insns + 2) * InsSize;
+    globals = stores + num_vars;
+    while (s<=e) {
+        if (insn(s)[IOp]==LI || insn(s)[IOp]==LC) {
+            var = insn(live_before(s));
+            if (var[IOp]==LEA) {
+                // new locals are outside the range, and left alone
+                if (var[IEscape] || var[IArg]<first_var || var[IArg]>=first_var + num_vars
+                    || stores[var[IArg] - first_var]) {
+                    return 0;
+                }
+            } else if (clobbered) {
+                return 0;
+            } else {
+                i = globals[0];
+                while (i) {
+                    if (same_operand(insn(globals[i--]), var)) {
+                        return 0;
+                    }
+                }
+            }
+        }
+        s = live(s + 1);
+    }
+    return 1;
+}
+
+int new_local() {
+    // add a local to the frame of the function, returns its offset to bp
+    insn(0)[IArg]++;
+    return -insn(0)[IArg];
+}
+
+int no_labels(int s, int e) {
+    // whether there are no jumps to the instructions after `s` up to `e`
+    while ((s = live(s + 1))<=e) {
+        if (insn(s)[ILabel]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int match_expr(int i, int s, int e) {
+    // end of the copy of the expression from `s` to `e` which starts at `i`,
+    // -1 if the code there is different
+    while (1) {
+        if (!same_operand(insn(i), insn(s)) || (i!=s && insn(i)[ILabel])) {
+            return -1;
+        }
+        if (s==e) {
+            return i;
+        }
+        i = live(i + 1);
+        s = live(s + 1);
+    }
+    return -1;
+}
+
+int reuse(int replace, int s, int e, int t) {
+    // count the later copies of the expression from `s` to `e` in the same
+    // block which compute the same value, and replace them by loads of the
+    // local `t` if `replace` is set. The copies are looked for up to the
+    // first instruction which may change the value, and CSE_WINDOW
+    // instructions at most
+    int i, j, n, globals, window;
+    n = 0;
+    if ((globals = global_loads(s, e))<0) {
+        return 0;
+    }
+    window = CSE_WINDOW;
+    i = live(e + 1);
+    while (i<num_insns && !insn(i)[ILabel] && window-- && !changes(i, s, e, globals)) {
+        j = match_expr(i, s, e);
+        if (j>=0 && expr_start(j, i)==i) {
+            n++;
+            if (replace) {
+                insn(i)[IOp] = LEA;
+                insn(i)[IArg] = t;
+                insn(i)[ITag] = insn(i)[IEscape] = 0;
+                while ((i = live(i + 1))<j) {
+                    drop(i);
+                }
+                insn(j)[IOp] = LI;
+                insn(j)[IArg] = insn(j)[ITag] = 0;
+            }
+            i = j;
+        }
+        i = live(i + 1);
+    }
+    return n;
+}
+
+int eliminate_common() {
+    // compute an expression once if it's repeated in a basic block, and keep
+    // its value in a new local for the copies, returns whether anything changed
+    //
+    // ----- origin -----       ----- rewritten -----
+    //                          LEA <temp>
+    //                          PUSH
+    // <expr>                   <expr>
+    //                          SI
+    // ...                      ...
+    // <expr>                   LEA <temp>
+    //                          LI
+    //
+    // the copies are replaced during one sweep, and the code which saves the
+    // values is inserted after it
+    int e, s, i, n, m, last, changed, *ins;
+
+    find_escapes();
+    changed = last = 0;
+    e = live(0);
+    while (e<num_insns) {
+        ins = insn(e);
+        if (ins[IOp]>=OR && ins[IOp]<=NEG && (s = expr_start(e, last + 1))>=0 && no_labels(s, e)) {
+            m = 0;
+            i = s;
+            while (i<=e) {
+                m++;
+                i = live(i + 1);
+            }
+            n = reuse(0, s, e, 0);
+            if ((m - 2) * n>3) {
+                insn(s)[ISave] = new_local();
+                ins[ISave] = 1;
+                reuse(1, s, e, insn(s)[ISave]);
+                changed = 1;
+                last = e;
+            }
+        }
+        e = live(e + 1);
+    }
+    if (changed) {
+        save_values();
+    }
+    return changed;
+}
+
+int hoist(int head, int tail) {
+    // move the computations which are the same in every iteration of the loop
+    // from `head` to `tail` into new locals before the loop, returns the
+    // number of instructions inserted
+    //
+    // ----- origin -----       ----- hoisted -----
+    //                          LEA <temp>
+    //                          PUSH
+    //                          <expr>
+    //                          SI
+    // head:                    head:
+    //   ...                      ...
+    //   <expr>                   LEA <temp>
+    //   ...                      LI
+    //   JNZ head                 ...
+    //                            JNZ head
+    int i, e, s, n, k, clobbered, *ins;
+
+    // the loop must be entered from its head only
+    i = 0;
+    while (i<num_insns) {
+        ins = insn(i);
+        if (is_jump(ins[IOp]) && (i<head || i>tail) && ins[IArg]>head && live(ins[IArg])<=tail) {
+            return 0;
+        }
+        i++;
+    }
+
+    // mark the expressions in the loop worth moving, which have an operator,
+    // and no jumps into them, each with a new local
+    clobbered = loop_stores(head, tail);
+    n = 0;
+    e = tail;
+    while ((e = live_before(e))>=head) {
+        ins = insn(e);
+        if (ins[IOp]>=OR && ins[IOp]<=NEG && (s = expr_start(e, head))>=0
+            && invariant(s, e, clobbered) && no_labels(s, e)) {
+            insn(s)[ISave] = new_local();
+            ins[ISave] = 1;
+            n = n + 3;
+            i = s;
+            while (i<=e) {
+                n++;
+                i = live(i + 1);
+            }
+            e = s;
+        }
+    }
+    if (!n) {
+        return 0;
+    }
+    insert_insns(head, n);
+    tail = tail + n;
+
+    // jumps from outside of the loop go through the new code
+    i = 0;
+    while (i<num_insns) {
+        ins = insn(i);
+        if (is_jump(ins[IOp]) && (i<head || i>tail) && live(ins[IArg])==head + n) {
+            set_target(i, head);
+        }
+        i++;
+    }
+
+    // copy the marked expressions in their order, and replace them by loads
+    // of their locals
+    k = head;
+    s = head + n;
+    while (s<=tail) {
+        if (insn(s)[ISave]<0) {
+            e = s;
+            while (insn(e)[ISave]<=0) {
+                e = live(e + 1);
+            }
+            ins = insn(k++);
+            ins[IOp] = LEA;
+            ins[IArg] = insn(s)[ISave];
+            insn(k++)[IOp] = PUSH;
+            i = s;
+            while (i<=e) {
+                ins = insn(k++);
+                ins[IOp] = insn(i)[IOp];
+                ins[IArg] = insn(i)[IArg];
+                ins[ITag] = insn(i)[ITag];
+                ins[IEscape] = insn(i)[IEscape];
+                if (i!=s && i!=e) {
+                    drop(i);
+                }
+                i = live(i + 1);
+            }
+            insn(k++)[IOp] = SI;
+
+            ins = insn(s);
+            ins[IOp] = LEA;
+            ins[IArg] = ins[ISave];
+            ins[ITag] = ins[IEscape] = ins[ISave] = 0;
+            ins = insn(e);
+            ins[IOp] = LI;
+            ins[IArg] = ins[ITag] = ins[ISave] = 0;
+            s = e;
+        }
+        s = live(s + 1);
+    }
+    return n;
+}
+
+int hoist_invariants() {
+    // hoist computations out of loops, which are found by their backward
+    // jumps, the escaping locals are found once for all of them
+    int i, n, changed, *ins;
+    find_escapes();
+    changed = 0;
+    i = live(0);
+    while (i<num_insns) {
+        ins = insn(i);
+        if (is_jump(ins[IOp]) && !ins[IFixed] && ins[IArg]<=i) {
+            n = hoist(live(ins[IArg]), i);
+            if (n) {
+                changed = 1;
+                i = i + n;
+            }
+        }
+        i = live(i + 1);
+    }
+    return changed;
+}
+
+int eliminate_dead() {
+    // remove the instructions which are never executed, and the loads whose
+    // values are overwritten before being used, returns whether anything changed
+    int i, j, n, op, changed, *ins;
+
+    // mark the instructions reachable from the entry, until nothing changes
+    i = 0;
+    while (i<num_insns) {
+        insn(i++)[IAddr] = 0;
+    }
+    insn(0)[IAddr] = 1;
+    changed = 1;
+    while (changed) {
+        changed = 0;
+        i = 0;
+        while (i<num_insns) {
+            ins = insn(i);
+            op = ins[IOp];
+            if (ins[IAddr] && op!=NOP) {
+                n = 0;
+                if (op==JTAB) {
+                    n = ins[IArg] + 1;
+                } else if (op==JBIN) {
+                    n = 2 * ins[IArg] + 1;
+                } else if (op!=JMP && op!=LEV) {
+                    n = 1;
+                }
+                // the next instructions, which are the entries of jump tables
+                j = i;
+                while (n--) {
+                    j = live(j + 1);
+                    if (j<num_insns && !insn(j)[IAddr]) {
+                        insn(j)[IAddr] = changed = 1;
+                    }
+                }
+                if (is_jump(op) && !insn(j = live(ins[IArg]))[IAddr]) {
+                    insn(j)[IAddr] = changed = 1;
+                }
+            }
+            i++;
+        }
+    }
+
+    i = live(0);
+    while (i<num_insns) {
+        ins = insn(i);
+        j = live(i + 1);
+        op = insn(j)[IOp];
+        if (!ins[IAddr]) {
+            drop(i);
+            changed = 1;
+        } else if ((ins[IOp]==IMM || ins[IOp]==LEA || ins[IOp]==LSP) && !ins[IFixed]
+            && (op==IMM || op==LEA || op==LSP) && !insn(j)[IFixed]) {
+            // the register is loaded again
+            drop(i);
+            changed = 1;
+        }
+        i = j;
+    }
+    return changed;
+}
+
+int successor(int i, int k) {
+    // index of the `k`th instruction which may run after instruction `i`,
+    // -1 if there are no more
+    int op, n;
+    op = insn(i)[IOp];
+    if (op==JTAB || op==JBIN) {
+        // the entries of the jump table
+        n = (op==JTAB) ? insn(i)[IArg] + 1 : 2 * insn(i)[IArg] + 1;
+        if (k>=n) {
+            return -1;
+        }
+        while (k-->=0) {
+            i = live(i + 1);
+        }
+        return i;
+    } else if (is_jump(op) && !k) {
+        i = live(insn(i)[IArg]);
+    } else if (op==JMP || op==LEV || op==RET || k>1 || (k==1 && !is_jump(op))) {
+        return -1;
+    } else {
+        i = live(i + 1);
+    }
+    return i<num_insns ? i : -1;
+}
+
+int var_of(int *ins) {
+    // index of the variable whose address `ins` loads, -1 if not tracked
+    int v;
+    if (ins[IOp]!=LEA) {
+        return -1;
+    }
+    v = ins[IArg] - first_var;
+    if (v<0 || v>=num_vars || !var_tracked[v]) {
+        return -1;
+    }
+    return v;
+}
+
+int *var_state(int i) {
+    return var_states + i * num_vars * 2;
+}
+
+void find_vars() {
+    // the variables of the frame, whether their addresses are not taken, and
+    // room for their states
+    find_escapes();
+    var_states = var_tracked + num_vars;
+    grow(opt_pool, (int)(var_states + (num_insns + 2) * num_vars * 2));
+}
+
+void assign(int *state, int v, int kind, int value) {
+    // a new value of variable `v`, the copies of its old value are not anymore
+    int w;
+    w = 0;
+    while (w<num_vars) {
+        if (state[2 * w]==VCopy && state[2 * w + 1]==v) {
+            state[2 * w] = VAny;
+        }
+        w++;
+    }
+    state[2 * v] = kind;
+    state[2 * v + 1] = value;
+}
+
+void transfer(int i, int *state) {
+    // change the values of the variables in `state` by instruction `i`
+    //
+    // LEA <x>                  x is the constant c
+    // PUSH
+    // IMM <c>
+    // SI
+    //
+    // LEA <x>                  x is a copy of y, or the constant y is
+    // PUSH
+    // LEA <y>
+    // LI
+    // SI
+    //
+    // LEA <x>                  x is the constant c + k, if x was c
+    // INC <k>
+    int op, j, v, w, s, e, *ins;
+    ins = insn(i);
+    op = ins[IOp];
+    if ((op!=SI && op!=SC && op!=INC) || (j = store_target(i))<0 || (v = var_of(insn(j)))<0) {
+        return;
+    }
+    if (op==INC) {
+        if (state[2 * v]==VConst) {
+            assign(state, v, VConst, state[2 * v + 1] + ins[IArg]);
+        } else {
+            assign(state, v, VAny, 0);
+        }
+        return;
+    }
+    if (op==SI && !ins[ILabel]) {
+        s = live(pusher(i) + 1);
+        e = live_before(i);
+        if (s==e && insn(e)[IOp]==IMM && !insn(e)[ITag] && !insn(e)[ILabel]) {
+            assign(state, v, VConst, insn(e)[IArg]);
+            return;
+        }
+        w = var_of(insn(s));
+        if (w>=0 && w!=v && live(s + 1)==e && insn(e)[IOp]==LI && !insn(e)[ILabel]) {
+            if (state[2 * w]==VCopy && state[2 * w + 1]==v) {
+                // x = y, where y is a copy of x already
+                return;
+            } else if (state[2 * w]==VConst || state[2 * w]==VCopy) {
+                assign(state, v, state[2 * w], state[2 * w + 1]);
+            } else {
+                assign(state, v, VCopy, w);
+            }
+            return;
+        }
+    }
+    assign(state, v, VAny, 0);
+}
+
+int merge(int *to, int *from) {
+    // merge the values of the variables coming from another path,
+    // returns whether anything changed
+    int v, changed;
+    changed = 0;
+    v = 0;
+    while (v<num_vars) {
+        if (to[2 * v]==VUndef || (from[2 * v]!=VUndef && to[2 * v]!=VAny
+            && (to[2 * v]!=from[2 * v] || to[2 * v + 1]!=from[2 * v + 1]))) {
+            if (to[2 * v]==VUndef) {
+                to[2 * v] = from[2 * v];
+                to[2 * v + 1] = from[2 * v + 1];
+            } else {
+                to[2 * v] = VAny;
+            }
+            changed = changed || to[2 * v]!=VUndef;
+        }
+        v++;
+    }
+    return changed;
+}
+
+int propagate_values() {
+    // replace the loads of variables which are constants or copies of other
+    // variables, returns whether anything changed
+    //
+    // ----- origin -----       ----- rewritten -----
+    // LEA <x>                  IMM <c>                 x is c on every path
+    // LI
+    //
+    // LEA <x>                  LEA <y>                 x is a copy of y
+    // LI                       LI
+    int i, k, s, v, changed, *state, *cur;
+
+    find_vars();
+    cur = var_state(num_insns);
+    i = 0;
+    while (i<num_insns * num_vars * 2) {
+        var_states[i++] = VUndef;
+    }
+    // at the entry, the variables hold anything
+    i = 0;
+    while (i<num_vars) {
+        var_states[2 * i++] = VAny;
+    }
+
+    changed = 1;
+    while (changed) {
+        changed = 0;
+        i = 0;
+        while (i<num_insns) {
+            state = var_state(i);
+            if (insn(i)[IOp]!=NOP && state[0]!=VUndef) {
+                k = 0;
+                while (k<num_vars * 2) {
+                    cur[k] = state[k];
+                    k++;
+                }
+                transfer(i, cur);
+                k = 0;
+                while ((s = successor(i, k++))>=0) {
+                    changed = merge(var_state(s), cur) || changed;
+                }
+            }
+            i++;
+        }
+    }
+
+    changed = 0;
+    i = live(0);
+    while (i<num_insns) {
+        state = var_state(i);
+        k = live(i + 1);
+        if ((v = var_of(insn(i)))>=0 && insn(k)[IOp]==LI && !insn(k)[ILabel]) {
+            if (state[2 * v]==VConst) {
+                insn(i)[IOp] = IMM;
+                insn(i)[IArg] = state[2 * v + 1];
+                drop(k);
+                changed = 1;
+            } else if (state[2 * v]==VCopy && state[2 * v + 1]!=v) {
+                insn(i)[IArg] = first_var + state[2 * v + 1];
+                changed = 1;
+            }
+        }
+        i = live(i + 1);
+    }
+    return changed;
+}
+
+int eliminate_stores() {
+    // remove the stores to variables which are not loaded afterwards,
+    // returns whether anything changed
+    //
+    // ----- origin -----       ----- rewritten -----
+    // LEA <x>                  <expr>
+    // PUSH
+    // <expr>
+    // SI
+    //
+    // LEA <x>                  (nothing)               the register is
+    // INC <k>                                          loaded again
+    // IMM ...                  IMM ...
+    int i, j, k, s, v, changed, *live_in, *out, *ins;
+
+    // the variables whose values may be loaded later, from the end backwards
+    find_vars();
+    live_in = var_states;
+    out = live_in + (num_insns + 1) * num_vars;
+    i = 0;
+    while (i<num_insns * num_vars) {
+        live_in[i++] = 0;
+    }
+    changed = 1;
+    while (changed) {
+        changed = 0;
+        i = num_insns;
+        while (i-->0) {
+            ins = insn(i);
+            if (ins[IOp]!=NOP) {
+                k = 0;
+                while (k<num_vars) {
+                    out[k++] = 0;
+                }
+                k = 0;
+                while ((s = successor(i, k++))>=0) {
+                    j = 0;
+                    while (j<num_vars) {
+                        out[j] = out[j] || live_in[s * num_vars + j];
+                        j++;
+                    }
+                }
+                if (ins[IOp]==SI && (j = store_target(i))>=0 && (v = var_of(insn(j)))>=0) {
+                    out[v] = 0;
+                }
+                if ((v = var_of(ins))>=0) {
+                    j = live(i + 1);
+                    if (insn(j)[IOp]==PUSH) {
+                        j = live(j + 1);
+                    }
+                    if (insn(j)[IOp]==LI || insn(j)[IOp]==LC || insn(j)[IOp]==INC) {
+                        out[v] = 1;
+                    }
+                }
+                k = 0;
+                while (k<num_vars) {
+                    if (live_in[i * num_vars + k]!=out[k]) {
+                        live_in[i * num_vars + k] = out[k];
+                        changed = 1;
+                    }
+                    k++;
+                }
+            }
+        }
+    }
+
+    changed = 0;
+    i = live(0);
+    while (i<num_insns) {
+        ins = insn(i);
+        if ((ins[IOp]==SI || ins[IOp]==INC) && (j = store_target(i))>=0 && (v = var_of(insn(j)))>=0) {
+            k = 0;
+            s = 0;
+            while ((s = successor(i, k++))>=0 && !live_in[s * num_vars + v]) {
+                ;
+            }
+            if (s<0 && ins[IOp]==SI) {
+                drop(pusher(i)); drop(j); drop(i);
+                changed = 1;
+            } else if (s<0 && !ins[ILabel] && !insn(j)[ILabel]
+                && ((k = insn(live(i + 1))[IOp])==IMM || k==LEA || k==LSP)) {
+                drop(j); drop(i);
+                changed = 1;
+            }
+        }
+        i = live(i + 1);
+    }
+    return changed;
+}
+
+int elide_frame(int *id) {
+    // a function without locals or calls, which only loads its arguments,
+    // is entered without a frame: its `ENT -1` tells CALL not to make one,
+    // the arguments are loaded relative to the stack pointer, past the return
+    // address, and it returns by `RET`
+    int i, j, depth, *ins;
+
+    if (id==idmain || insn(0)[IArg]) {
+        return 0;
+    }
+    i = live(1);
+    while (i<num_insns) {
+        ins = insn(i);
+        j = live(i + 1);
+        if (ins[IOp]==CALL || (ins[IOp]==LEA
+            && (ins[IArg]<2 || insn(j)[IOp]!=LI || insn(j)[ILabel]))) {
+            return 0;
+        }
+        i = j;
+    }
+
+    depth = 0;
+    i = live(1);
+    while (i<num_insns) {
+        ins = insn(i);
+        if (ins[IOp]==LEA) {
+            ins[IOp] = LSP;
+            ins[IArg] = ins[IArg] - 1 + depth;
+            drop(live(i + 1));
+        } else if (ins[IOp]==LEV) {
+            ins[IOp] = RET;
+        } else {
+            depth = depth - stack_pops(ins);
+        }
+        i = live(i + 1);
+    }
+    insn(0)[IArg] = -1;
+    return 1;
+}
+
+int is_pure(int *f, int *limit, int depth) {
+    // whether the function at `f`, defined before `limit`, has no effect but
+    // its result as far as its code shows: it calls no built-in functions,
+    // loads no addresses of globals or strings, and calls pure functions only
+    int *p, *end, *g;
+    if (!f || f>=limit || *f!=ENT) {
+        return 0;
+    }
+    end = next_function(f);
+    p = f;
+    while (p<end) {
+        if (*p>=OPEN || (*p==IMM && tags[p + 1 - old_text])) {
+            return 0;
+        } else if (*p==CALL) {
+            g = (int *)p[1];
+            if (g!=f && (depth>=PURE_DEPTH || !is_pure(g, limit, depth + 1))) {
+                return 0;
+            }
+        }
+        p = p + 1 + has_arg(*p);
+    }
+    return 1;
+}
+
+int sandbox(int *f, int *stkinit, int n, int *result) {
+    // run the function at `f` with `n` arguments pushed down to `stkinit`,
+    // returns whether it returned within the budget, touching no memory but
+    // its own stack, with the value in `result`
+    int op, r, cycles, *p, *stk, *frame, *tmp, lo, hi;
+
+    // it returns to `ADJ <n>; EXIT` at the bottom of the stack
+    fold_stack[0] = ADJ;
+    fold_stack[1] = n;
+    fold_stack[2] = EXIT;
+    lo = (int)(fold_stack + 3);
+    hi = (int)(fold_stack + FOLD_STACK);
+    stk = stkinit;
+    frame = 0;
+    r = 0;
+    *--stk = (int)fold_stack;
+    if (f[1]>=0) { *--stk = (int)frame; frame = stk; stk = stk - f[1]; }
+    p = f + 2;
+    cycles = 0;
+    while (++cycles<FOLD_CYCLES && (int)stk>lo + 64 * sizeof(int)) {
+        op = *p++;
+        if ((op==LC || op==LI || op==INC) && (r<lo || r>hi - sizeof(int))) {
+            return 0;
+        } else if ((op==SC || op==SI) && (*stk<lo || *stk>hi - sizeof(int))) {
+            return 0;
+        } else if (op>=SHL && op<=MOD && !foldable(op, *stk, r)) {
+            return 0;   // it would trap, or the result is undefined
+        }
+        switch (op) {
+        case IMM:  r = *p++; break;
+        case LC:   r = *(char *)r; break;
+        case LI:   r = *(int *)r; break;
+        case SC:   *(char *)*stk++ = r; break;
+        case SI:   *(int *)*stk++ = r; break;
+        case PUSH: *--stk = r; break;
+        case JMP:  p = (int *)*p; break;
+        case JZ:   p = r ? p + 1 : (int *)*p; break;
+        case JNZ:  p = r ? (int *)*p : p + 1; break;
+        case JTAB: p = (int *)p[r>=0 && r<*p ? 2 * r + 2 : 2 * *p + 2]; break;
+        case JBIN: p = find_case(p, r); break;
+        case CALL: *--stk = (int)(p + 1); p = (int *)*p;
+                   if (p[1]>=0) { *--stk = (int)frame; frame = stk; stk = stk - p[1]; }
+                   p = p + 2; break;
+        case ENT:  *--stk = (int)frame; frame = stk; stk = stk - *p++; break;
+        case ADJ:  stk = stk + *p++; break;
+        case LEV:  stk = frame; frame = (int *)*stk++; p = (int *)*stk++;
+                   stk = stk + p[1]; p = p + 2; break;
+        case RET:  p = (int *)*stk++; stk = stk + p[1]; p = p + 2; break;
+        case LEA:  r = (int)(frame + *p++); break;
+        case LSP:  r = stk[*p++]; break;
+        case INC:  tmp = (int *)r; r = *tmp = *tmp + *p++; break;
+        case OR:   r = *stk++ |  r; break;
+        case XOR:  r = *stk++ ^  r; break;
+        case AND:  r = *stk++ &  r; break;
+        case EQ:   r = *stk++ == r; break;
+        case NE:   r = *stk++ != r; break;
+        case LT:   r = *stk++ <  r; break;
+        case LE:   r = *stk++ <= r; break;
+        case GT:   r = *stk++ >  r; break;
+        case GE:   r = *stk++ >= r; break;
+        case SHL:  r = *stk++ << r; break;
+        case SHR:  r = *stk++ >> r; break;
+        case ADD:  r = *stk++ +  r; break;
+        case SUB:  r = *stk++ -  r; break;
+        case MUL:  r = *stk++ *  r; break;
+        case DIV:  r = *stk++ / r; break;
+        case MOD:  r = *stk++ % r; break;
+        case NEG:  r = -r; break;
+        case EXIT: *result = r; return 1;   // returned to the bottom
+        default:   return 0;
+        }
+    }
+    return 0;
+}
+
+int fold_calls(int *start) {
+    // replace the calls of pure functions with constant arguments by their
+    // results, returns whether anything changed
+    //
+    // ----- origin -----       ----- folded -----
+    // IMM <a1>                 IMM <f(a1, ..., an)>
+    // PUSH
+    // ...
+    // IMM <an>
+    // PUSH
+    // CALL f
+    // ADJ <n>
+    int i, j, k, n, a, b, first, result, changed, *ins, *args;
+
+    if (!fold_stack && !(fold_stack = malloc(FOLD_STACK * sizeof(int)))) {
+        return 0;
+    }
+    changed = 0;
+    i = live(0);
+    while (i<num_insns) {
+        ins = insn(i);
+        j = live(i + 1);
+        if (ins[IOp]==CALL && insn(j)[IOp]==ADJ && !insn(j)[ILabel]
+            && is_pure((int *)ins[IArg], start, 0)) {
+            // the arguments, the last one is pushed last
+            n = insn(j)[IArg];
+            args = fold_stack + FOLD_STACK - n;
+            first = i;
+            k = 0;
+            while (k<n && !insn(first)[ILabel] && (a = live_before(first))>=0 && insn(a)[IOp]==PUSH
+                && !insn(a)[ILabel] && (b = live_before(a))>=0 && insn(b)[IOp]==IMM
+                && !insn(b)[ITag] && !insn(b)[IFixed]) {
+                args[k++] = insn(b)[IArg];
+                first = b;
+            }
+            if (k==n && sandbox((int *)ins[IArg], args, n, &result)) {
+                k = first;
+                while ((k = live(k + 1))<=j) {
+                    drop(k);
+                }
+                ins = insn(first);
+                ins[IOp] = IMM;
+                ins[IArg] = result;
+                ins[ITag] = 0;
+                changed = 1;
+            }
+        }
+        i = live(i + 1);
+    }
+    return changed;
+}
+
+int idiom_at;        // next instruction of the loop to match
+int idiom_head;      // first instruction of the loop
+int idiom_end;       // the `JNZ` which closes it
+int *idiom_vars;     // instructions which load the addresses of its variables
+int idiom_size;      // size of the elements
+int idiom_value;     // the constant stored, or the instruction of the bound
+
+int *take(int op) {
+    // match the next instruction of the loop to `op`, returns it, 0 if different
+    int *ins;
+    ins = insn(idiom_at);
+    if (idiom_at>idiom_end || ins[IOp]!=op || (idiom_at!=idiom_head && ins[ILabel])) {
+        return 0;
+    }
+    idiom_at = live(idiom_at + 1);
+    return ins;
+}
+
+int take_arg(int op, int arg) {
+    // match the next instruction to `op` with the constant operand `arg`
+    int *ins;
+    return (ins = take(op)) && ins[IArg]==arg && !ins[ITag];
+}
+
+int take_var(int k) {
+    // match the next instruction to the load of the address of a variable,
+    // a local or a global, which is the same as the earlier one if `k` is
+    // matched already, and another one otherwise
+    int *ins, i;
+    ins = insn(idiom_at);
+    if (!((ins[IOp]==LEA && !ins[ITag]) || (ins[IOp]==IMM && ins[ITag]))) {
+        return 0;
+    }
+    if (idiom_vars[k]) {
+        if (!same_operand((int *)idiom_vars[k], ins)) {
+            return 0;
+        }
+    } else {
+        i = 0;
+        while (i<4) {
+            if (idiom_vars[i] && same_operand((int *)idiom_vars[i], ins)) {
+                return 0;
+            }
+            i++;
+        }
+        idiom_vars[k] = (int)ins;
+    }
+    return take(ins[IOp])!=0;
+}
+
+void put(int op, int arg, int tag) {
+    // write the next instruction of the code which replaces the loop
+    int *ins;
+    ins = insn(idiom_at);
+    ins[IOp] = op;
+    ins[IArg] = arg;
+    ins[ITag] = tag;
+    idiom_at = live(idiom_at + 1);
+}
+
+void put_var(int k) {
+    // write the load of the address of variable `k`, and push it
+    int *var;
+    var = (int *)idiom_vars[k];
+    put(var[IOp], var[IArg], var[ITag]);
+    put(PUSH, 0, 0);
+}
+
+int match_loop() {
+    // the built-in instruction which does what the loop from `idiom_head`
+    // to `idiom_end` does, 0 if none
+    int *ins, mark, op, z;
+
+    idiom_at = idiom_head;
+    idiom_vars[0] = idiom_vars[1] = idiom_vars[2] = idiom_vars[3] = 0;
+    if (take_var(0) && (ins = take(INC)) && ((z = ins[IArg])==1 || z==sizeof(int))) {
+        idiom_size = z;
+        mark = idiom_at;
+        if (take(PUSH) && take_arg(IMM, z) && take(SUB) && take(PUSH)) {
+            // copy or fill
+            op = 0;
+            mark = idiom_at;
+            if (take_var(1) && take_arg(INC, z) && take(PUSH) && take_arg(IMM, z)
+                && take(SUB) && take((z==1) ? LC : LI)) {
+                op = MCPY;
+            } else {
+                idiom_at = mark;
+                idiom_vars[1] = 0;
+                if ((ins = take(IMM)) && !ins[ITag]) {
+                    idiom_value = ins[IArg];
+                    op = MFIL;
+                }
+            }
+            if (op && take((z==1) ? SC : SI) && take_var(2) && take_arg(INC, -1)
+                && take(PUSH) && take_arg(IMM, 1) && take(ADD) && take(JNZ)) {
+                return op;
+            }
+            return 0;
+        }
+        idiom_at = mark;
+        if (take_var(0) && take(LI) && take((z==1) ? LC : LI) && take(JNZ)) {
+            return SLEN;
+        }
+        return 0;
+    }
+
+    // sum
+    idiom_at = idiom_head;
+    idiom_vars[0] = idiom_vars[1] = idiom_vars[2] = idiom_vars[3] = 0;
+    if (take_var(0) && take(PUSH) && take_var(1) && take(LI) && take(PUSH)
+        && take_arg(IMM, power_of_two(sizeof(int))) && take(SHL) && take(PUSH)
+        && take_var(2) && take(LI) && take(ADD) && take(LI) && take(PUSH)
+        && take_var(0) && take(LI) && take(ADD) && take(SI)
+        && take_var(1) && take_arg(INC, 1) && take_var(1) && take(LI) && take(PUSH)) {
+        idiom_value = idiom_at;
+        if ((((ins = take(IMM)) && !ins[ITag]) || (take_var(3) && take(LI)))
+            && take(LT) && take(JNZ)) {
+            return MSUM;
+        }
+    }
+    return 0;
+}
+
+int recognize_idioms() {
+    // replace the loops which copy, fill, scan or sum up memory by the
+    // built-in instructions, returns whether anything changed
+    //
+    // the loops are compiled with their tests at the end, and the first
+    // test before them, only the part from the label is replaced
+    //
+    // ----- origin -----       ----- replaced -----
+    // while (n--)              LEA/IMM <d>  PUSH
+    //     *d++ = *s++;         LEA/IMM <s>  PUSH
+    //                          LEA/IMM <n>  PUSH
+    //                          IMM <size>   PUSH
+    //                          MCPY
+    //                          ADJ 4
+    //
+    // while (n--)              <d>, <c>, <n> and <size> to MFIL
+    //     *d++ = <c>;
+    //
+    // while (*p)               <p> and <size> to SLEN
+    //     p++;
+    //
+    // while (i < <n>) {        <s>, <i>, <a> and the value of <n> to MSUM
+    //     s = s + a[i];
+    //     i++;
+    // }
+    //
+    // where <c> is a constant, <n> a constant or a variable, the
+    // elements are chars or ints, and the variables are different
+    int tail, op, *ins;
+
+    idiom_vars = insns + (num_insns + 2) * InsSize;
+    grow(opt_pool, (int)(idiom_vars + 4));
+    tail = live(0);
+    while (tail<num_insns) {
+        ins = insn(tail);
+        op = 0;
+        if (ins[IOp]==JNZ && !ins[IFixed] && live(ins[IArg])<tail) {
+            idiom_head = live(ins[IArg]);
+            idiom_end = tail;
+            if (insn(idiom_head)[ILabel]==1) {
+                op = match_loop();
+            }
+        }
+
+        if (op && idiom_at>tail) {
+            // the jump back becomes a place for the new code too
+            set_target(tail, -1);
+            insn(tail)[IOp] = ADJ;
+            insn(tail)[IArg] = 0;
+            idiom_at = idiom_head;
+            put_var(0);
+            if (op==MCPY) {
+                put_var(1);
+            } else if (op==MFIL) {
+                put(IMM, idiom_value, 0);
+                put(PUSH, 0, 0);
+            } else if (op==MSUM) {
+                put_var(1);
+                put_var(2);
+                ins = insn(idiom_value);
+                put(ins[IOp], ins[IArg], ins[ITag]);
+                if (ins[IOp]==LEA || ins[ITag]) {
+                    put(LI, 0, 0);
+                }
+                put(PUSH, 0, 0);
+            }
+            if (op==MCPY || op==MFIL) {
+                put_var(2);
+            }
+            if (op!=MSUM) {
+                put(IMM, idiom_size, 0);
+                put(PUSH, 0, 0);
+            }
+            put(op, 0, 0);
+            put(ADJ, (op==SLEN) ? 2 : 4, 0);
+            while (idiom_at<=tail) {
+                drop(idiom_at);
+                idiom_at = live(idiom_at + 1);
+            }
+            return 1;
+        }
+        tail = live(tail + 1);
+    }
+    return 0;
+}
+
+void optimize(int *id) {
+    // optimize the function which is just compiled
+    int *start, before, after, changed;
+    char *name;
+
+    start = (int *)id[Value] - 1;
+    before = decode(start);
+    changed = 1;
+    while (changed) {
+        changed = peephole();
+        changed = thread_jumps() || changed;
+        changed = eliminate_dead() || changed;
+        changed = eliminate_common() || changed;
+        changed = hoist_invariants() || changed;
+        changed = fold_calls(start) || changed;
+        changed = recognize_idioms() || changed;
+        if (opt_level>1) {
+            changed = propagate_values() || changed;
+            changed = eliminate_stores() || changed;
+        }
+    }
+    elide_frame(id);
+    after = encode(start);
+
+    if (verbose) {
+        name = (char *)id[Name];
+        printf("%.*s: %d -> %d instructions\n", id_length(name), name, before, after);
+    }
+}
+
+int *link_symbol(int hash, char *name, int len, int class, int type, int value) {
+    // merge a declaration of one unit into the link table
+    // global variables behave like common symbols, the first definition wins
+    int *entry;
+    entry = links;
+    while (entry[LName] && !(entry[LHash]==hash && entry[LLen]==len && !memcmp((char *)entry[LName], name, len))) {
+        entry = entry + LinkSize;
+    }
+
+    if (!entry[LName]) {
+        grow(link_pool, (int)(entry + LinkSize));
+        entry[LHash]  = hash;
+        entry[LName]  = (int)name;
+        entry[LLen]   = len;
+        entry[LClass] = class;
+        entry[LType]  = type;
+    } else if (entry[LClass]!=class) {
+        printf("Conflicting declarations of `%.*s`\n", len, name);
+        exit(-1);
+    }
+
+    if (value) {
+        if (class==Fun && entry[LValue]) {
+            printf("Duplicate definition of `%.*s`\n", len, name);
+            exit(-1);
+        }
+        if (!entry[LValue]) {
+            entry[LValue] = value;
+        }
+    }
+    return entry;
+}
+
+void export_unit(int *start) {
+    // move the global identifiers of the unit into the link table,
+    // the symbol table is cleared before compiling the next unit
+    int *id;
+
+    id = symbols;
+    while (id[Token]) {
+        if (id[Class]==Fun || id[Class]==Glo) {
+            id[Link] = (int)link_symbol(id[Hash], (char *)id[Name], id_length((char *)id[Name]), id[Class], id[Type], id[Value]);
+        }
+        id = id + IdSize;
+    }
+
+    // tags of the unit refer to the link table from now on
+    while (start<text) {
+        start++;
+        if (tags[start - old_text]>RDATA) {
+            id = (int *)tags[start - old_text];
+            tags[start - old_text] = id[Link];
+        }
+    }
+}
+
+int link_image() {
+    // resolve the references between units
+    int *slot, *entry;
+
+    slot = old_text;
+    while (slot<text) {
+        slot++;
+        entry = (int *)tags[slot - old_text];
+        if ((int)entry>RDATA) {
+            if (!entry[LValue]) {
+                printf("Undefined reference to `%.*s`\n", entry[LLen], (char *)entry[LName]);
+                return -1;
+            }
+            *slot = entry[LValue];
+        }
+    }
+    return 0;
+}
+
+int *next_function(int *f) {
+    // the start of the function after the one at `f`, or the end of text
+    f = f + 2;
+    while (f<=text && *f!=ENT) {
+        f = f + (has_arg(*f) ? 2 : 1);
+    }
+    return f;
+}
+
+int strip_image() {
+    // remove the functions which can't be called from main(), the tag of
+    // ENT marks the functions which are reached
+    int *f, *end, *p, *to, *entry, n, size, changed;
+
+    entry = link_symbol(idmain[Hash], (char *)idmain[Name], 4, Fun, INT, 0);
+    if (!entry[LValue]) {
+        return 0;
+    }
+    tags[(int *)entry[LValue] - old_text] = 1;
+    changed = 1;
+    while (changed) {
+        changed = 0;
+        f = old_text + 1;
+        while (f<=text) {
+            end = next_function(f);
+            if (tags[f - old_text]) {
+                p = f;
+                while (p<end) {
+                    if (*p==CALL && !tags[(int *)p[1] - old_text]) {
+                        tags[(int *)p[1] - old_text] = changed = 1;
+                    }
+                    p = p + (has_arg(*p) ? 2 : 1);
+                }
+            }
+            f = end;
+        }
+    }
+
+    // move the functions which are kept together, the jumps inside of them
+    // move along, and the calls are resolved again from the link table
+    size = text - old_text;
+    to = old_text + 1;
+    f = old_text + 1;
+    while (f<=text) {
+        end = next_function(f);
+        entry = links;
+        while (entry[LName] && !(entry[LClass]==Fun && entry[LValue]==(int)f)) {
+            entry = entry + LinkSize;
+        }
+        if (entry[LName]) {
+            entry[LValue] = tags[f - old_text] ? (int)to : 0;
+        }
+        if (tags[f - old_text]) {
+            tags[f - old_text] = 0;
+            p = f;
+            while (p<end) {
+                if (is_jump(*p)) {
+                    p[1] = p[1] - (p - to) * sizeof(int);
+                }
+                n = has_arg(*p) ? 2 : 1;
+                while (n--) {
+                    tags[to - old_text] = tags[p - old_text];
+                    *to++ = *p++;
+                }
+            }
+        }
+        f = end;
+    }
+    text = to - 1;
+    while (to<=old_text + size) {
+        tags[to - old_text] = 0;
+        *to++ = 0;
+    }
+    if (verbose) {
+        printf("image: %d -> %d words\n", size, text - old_text);
+    }
+    return link_image();
+}
+
+// With `-m`, the results of the pure recursive functions are cached while
+// the program runs: their `ENT` becomes `MENT`, and CALL looks the arguments
+// up in a table of the function first. When they are not found, the function
+// returns through `ADJ 0; MRET`, which stores the result for the arguments.
+// Pointers among the arguments would make the cache wrong when the memory
+// they point to changes, so the functions must not load or store anything
+// but their own variables.
+// struct memo {
+//     int fun;          // address of the function
+//     char *name;       // and its name, with its length
+//     int len;
+//     int *table;       // MEMO_SLOTS entries: used, MEMO_ARGS arguments, result
+//     int calls;
+//     int hits; };
+enum { MFun, MName, MLen, MTable, MCalls, MHits, MemoSize };
+enum { MEMO_SLOTS = 4096, MEMO_ARGS = 4, MEMO_DEPTH = 65536, MEMO_MAX = 64 };
+int memoize;         // cache the results of pure recursive functions
+int *memos;          // the memoized functions
+int num_memos;
+int *memo_stack;     // calls being computed: memo, slot, arguments, return address
+int memo_depth;
+int *memo_stub;      // `ADJ 0; MRET`, where they return to
+
+int own_memory(int *f, int depth) {
+    // whether the function at `f`, and the functions it calls, load and
+    // store nothing but their own variables: `LI`, `LC` and `INC` come right
+    // after `LEA`, and so does the `PUSH` of every address `SI` or `SC` take
+    int *p, *end, *last, kinds, d;
+    end = next_function(f);
+    last = p = f;
+    kinds = d = 0;   // bit `i` of `kinds` tells whether word `i` pushed is an address
+    while (p<end) {
+        if ((*p==LI || *p==LC || *p==INC) && *last!=LEA) {
+            return 0;
+        } else if (*p==PUSH) {
+            if (d>=60) {
+                return 0;
+            }
+            if (*last==LEA) {
+                kinds = kinds | (1 << d);
+            } else {
+                kinds = kinds & ~(1 << d);
+            }
+            d++;
+        } else if (*p==SI || *p==SC) {
+            if (d<1 || !(kinds & (1 << --d))) {
+                return 0;
+            }
+        } else if (*p>=OR && *p<=MOD) {
+            d--;
+        } else if (*p==ADJ) {
+            d = d - p[1];
+        } else if (*p==CALL && (int *)p[1]!=f && (depth>=PURE_DEPTH || !own_memory((int *)p[1], depth + 1))) {
+            return 0;
+        }
+        if (d<0) {
+            return 0;
+        }
+        last = p;
+        p = p + 1 + has_arg(*p);
+    }
+    return 1;
+}
+
+void memoize_image() {
+    // find the pure functions which call themselves, and mark them by `MENT`
+    int *f, *end, *p, *entry, *m, main_fun, recursive;
+    if (!(memos = malloc(MEMO_MAX * MemoSize * sizeof(int)))
+        || !(memo_stack = malloc(MEMO_DEPTH * (MEMO_ARGS + 3) * sizeof(int)))
+        || !(memo_stub = malloc(3 * sizeof(int)))) {
+        printf("Could not malloc() for memoization\n");
+        exit(-1);
+    }
+    memo_stub[0] = ADJ;
+    memo_stub[1] = 0;
+    memo_stub[2] = MRET;
+    num_memos = memo_depth = 0;
+
+    entry = link_symbol(idmain[Hash], (char *)idmain[Name], 4, Fun, INT, 0);
+    main_fun = entry[LValue];
+    f = old_text + 1;
+    while (f<=text && num_memos<MEMO_MAX) {
+        end = next_function(f);
+        recursive = 0;
+        p = f;
+        while (p<end) {
+            recursive = recursive || (*p==CALL && (int *)p[1]==f);
+            p = p + 1 + has_arg(*p);
+        }
+        if (recursive && (int)f!=main_fun && is_pure(f, text + 1, 0) && own_memory(f, 0)) {
+            m = memos + MemoSize * num_memos++;
+            m[MFun] = (int)f;
+            entry = links;
+            while (entry[LName] && !(entry[LClass]==Fun && entry[LValue]==(int)f)) {
+                entry = entry + LinkSize;
+            }
+            m[MName] = entry[LName];
+            m[MLen] = entry[LLen];
+            m[MCalls] = m[MHits] = 0;
+            if (!(m[MTable] = (int)malloc(MEMO_SLOTS * (MEMO_ARGS + 2) * sizeof(int)))) {
+                printf("Could not malloc() for memoization\n");
+                exit(-1);
+            }
+            memset((char *)m[MTable], 0, MEMO_SLOTS * (MEMO_ARGS + 2) * sizeof(int));
+        }
+        f = end;
+    }
+    // only after all are checked, `is_pure()` wants `ENT`
+    m = memos;
+    while (m<memos + MemoSize * num_memos) {
+        *(int *)m[MFun] = MENT;
+        m = m + MemoSize;
+    }
+}
+
+// object file, in words
+//    header:  OBJMAGIC, #text words, #data bytes, #links, #name bytes,
+//             base address of text, base address of data
+//    links:   class, type, value, hash, length of name   (for each entry)
+//    names:   names of the links, concatenated
+//    text:    words of text section
+//    tags:    0, RDATA, or 2 + index of link
+//    data:    bytes of data section
+int write_object(char *path) {
+    int fd, n, m, names, size, i, *obj, *p, *entry;
+    char *c;
+
+    n = text - old_text;
+    size = ((int)data - (int)old_data + sizeof(int) - 1) & -sizeof(int);
+    m = 0;
+    names = 0;
+    entry = links;
+    while (entry[LName]) {
+        m++;
+        names = names + entry[LLen];
+        entry = entry + LinkSize;
+    }
+    names = (names + sizeof(int) - 1) & -sizeof(int);
+
+    i = (7 + m * 5 + 2 * n) * sizeof(int) + names + size;
+    if (!(obj = malloc(i))) {
+        printf("Could not malloc(%d) for object\n", i);
+        return -1;
+    }
+    memset(obj, 0, i);
+    obj[0] = OBJMAGIC;
+    obj[1] = n;
+    obj[2] = size;
+    obj[3] = m;
+    obj[4] = names;
+    obj[5] = (int)(old_text + 1);
+    obj[6] = (int)old_data;
+
+    p = obj + 7;
+    c = (char *)(p + m * 5);
+    entry = links;
+    while (entry[LName]) {
+        *p++ = entry[LClass];
+        *p++ = entry[LType];
+        *p++ = entry[LValue];
+        *p++ = entry[LHash];
+        *p++ = entry[LLen];
+        i = 0;
+        while (i<entry[LLen]) {
+            *c++ = ((char *)entry[LName])[i++];
+        }
+        entry = entry + LinkSize;
+    }
+
+    p = (int *)((int)p + names);
+    i = 0;
+    while (i<n) {
+        p[i] = old_text[i + 1];
+        p[n + i] = tags[i + 1];
+        if (p[n + i]>RDATA) {
+            p[n + i] = ((int *)p[n + i] - links) / LinkSize + 2;
+        }
+        i++;
+    }
+
+    c = (char *)(p + 2 * n);
+    i = 0;
+    while (i<size) {
+        c[i] = old_data[i];
+        i++;
+    }
+
+    if ((fd = open(path, 577, 420)) < 0) { // O_WRONLY | O_CREAT | O_TRUNC, 0644
+        printf("Could not open(%s)\n", path);
+        return -1;
+    }
+    i = (int)c + size - (int)obj;
+    if (write(fd, obj, i)!=i) {
+        printf("Could not write(%s)\n", path);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+void load_text(int *code, int *codetags, int n, int tdelta, int ddelta, int *map) {
+    // append `n` words of text, relocating the operands while copying them
+    // the tags are 0, RDATA, or 2 + index of the identifier in `map`
+    int i, op, tag, value;
+
+    reserve_text(n);
+    i = 0;
+    while (i<n) {
+        op = *++text = code[i++];
+        if (has_arg(op)) {
+            value = code[i];
+            tag = codetags[i++];
+            if (tag==RDATA) {
+                value = value + ddelta;
+            } else if (tag) {
+                tag = map[tag - 2];
+            } else if (op==JMP || op==JZ || op==JNZ || op==CALL) {
+                value = value + tdelta;
+            }
+            *++text = value;
+            reloc(tag);
+        }
+    }
+}
+
+void load_data(char *c, int size) {
+    // append `size` bytes to data section
+    grow(data_pool, (int)data + size);
+    while (size--) {
+        *data++ = *c++;
+    }
+}
+
+void load_object(int *obj) {
+    // append a unit of an object file to text and data sections
+    int n, m, i, tdelta, ddelta, value, *map, *p;
+    char *name;
+
+    n = obj[1];
+    m = obj[3];
+    data = (char *)(((int)data + sizeof(int) - 1) & -sizeof(int));
+    tdelta = (int)(text + 1) - obj[5];
+    ddelta = (int)data - obj[6];
+
+    if (!(map = malloc(m * sizeof(int) + 1))) {
+        printf("Could not malloc(%d) for object\n", m * sizeof(int) + 1);
+        exit(-1);
+    }
+    p = obj + 7;
+    name = (char *)(p + m * 5);
+    i = 0;
+    while (i<m) {
+        value = p[2];
+        if (value) {
+            value = value + ((p[0]==Fun) ? tdelta : ddelta);
+        }
+        map[i++] = (int)link_symbol(p[3], name, p[4], p[0], p[1], value);
+        name = name + p[4];
+        p = p + 5;
+    }
+
+    p = (int *)((int)p + obj[4]);
+    load_text(p, p + n, n, tdelta, ddelta, map);
+    load_data((char *)(p + 2 * n), obj[2]);
+}
+
+char *map_file(char *path) {
+    // map or read a whole file, 0 if it can't be opened
+    int fd, i, n, *pool;
+    char *buf;
+
+    if (path[0]=='-' && !path[1]) {
+        fd = 0;  // standard input
+    } else if ((fd = open(path, 0)) < 0) {
+        return 0;
+    }
+
+    // regular files are mapped and lexed from the mapping without copying,
+    // the zero-filled page after the file serves as the EOF character
+    if ((n = lseek(fd, 0, 2)) > 0) { // SEEK_END
+        map_len = n;
+        buf = (char *)mmap(0, n + 4096, PROT_RO, MAP_ANON_PRIVATE, -1, 0);
+        if ((int)buf==-1 || (int)mmap(buf, n, PROT_RO, MAP_FILE_FIXED, fd, 0)==-1) {
+            printf("Could not mmap(%s)\n", path);
+            exit(-1);
+        }
+        close(fd);
+        return buf;
+    }
+
+    // pipes can't be mapped, read them until EOF instead,
+    // the source area grows along with it
+    pool = new_pool("source", poolsz);
+    buf = (char *)pool[PBase];
+    i = 0;
+    n = 1;
+    while (n) {
+        grow(pool, (int)buf + i + 1);
+        if ((n = read(fd, buf + i, pool[PCommit] - (int)buf - i - 1)) < 0) {
+            printf("read() returned %d\n", n);
+            exit(-1);
+        }
+        i = i + n;
+    }
+
+    buf[i] = 0; // 0 as '\0' representing a EOF character
+    map_len = i;
+    close(fd);
+    return buf;
+}
+
+char *read_file(char *path) {
+    char *buf;
+    if (!(buf = map_file(path))) {
+        printf("Could not open(%s)\n", path);
+        exit(-1);
+    }
+    return buf;
+}
+
+int str_length(char *p) {
+    char *q;
+    q = p;
+    while (*q) q++;
+    return q - p;
+}
+
+char *copy_string(char *from, int len, char *suffix) {
+    // a NUL terminated copy of `len` bytes, followed by `suffix`
+    char *str, *p;
+    if (!(p = str = malloc(len + str_length(suffix) + 1))) {
+        printf("Could not malloc(%d) for string\n", len + 1);
+        exit(-1);
+    }
+    while (len--) *p++ = *from++;
+    while ((*p++ = *suffix++)) ;
+    return str;
+}
+
+int content_hash(char *p, int len) {
+    // hash of the content of a file, the same way as identifiers
+    int hash;
+    hash = 0;
+    while (len--) {
+        hash = hash * 147 + *p++;
+    }
+    return hash;
+}
+
+int is_included(int hash, int len) {
+    int i;
+    i = 0;
+    while (i<num_included) {
+        if (included[i * 3]==hash && included[i * 3 + 1]==len) {
+            return 1;
+        }
+        i++;
+    }
+    return 0;
+}
+
+void add_included(int hash, int len, char *path) {
+    grow(include_pool, (int)(included + num_included * 3 + 3));
+    included[num_included * 3]     = hash;
+    included[num_included * 3 + 1] = len;
+    included[num_included * 3 + 2] = (int)path;
+    num_included++;
+}
+
+void depend(int *id) {
+    // an included file refers to or declares an identifier which exists
+    // before it, so the result of compiling it depends on the including file
+    int *frame;
+    frame = includes + include_depth * IncSize;
+    while (frame>includes && (int *)frame[ISymbols]>id) {
+        frame[ICache] = 0;
+        frame = frame - IncSize;
+    }
+}
+
+// cache file, in words
+//    header:  CACHEMAGIC, EXIT, content hash, length of content, #text words,
+//             #data bytes, #identifiers, #name bytes, #nested includes,
+//             base address of text, base address of data, checksum
+//    nested:  content hash, length of content, length of path   (for each file)
+//    ids:     token, class, type, value, hash, length of name  (for each id)
+//    names:   paths of nested includes, then NUL terminated names of identifiers
+//    text:    words of text section
+//    tags:    0, RDATA, or 2 + index of identifier
+//    data:    bytes of data section
+// EXIT is the number of instructions, caches of another compiler or of another
+// optimization level are ignored. The checksum is the content hash of all the
+// words after the header.
+enum { CHeader = 12, CNested = 3, CId = 6 };
+
+void write_cache(int *frame) {
+    int fd, n, m, nested, names, size, i, *obj, *p, *id, *start;
+    char *c, *path, *file;
+
+    start = (int *)frame[IText];
+    n = text - start;
+    size = ((int)data - frame[IData] + sizeof(int) - 1) & -sizeof(int);
+    nested = num_included - frame[IIncluded];
+
+    names = 0;
+    i = frame[IIncluded];
+    while (i<num_included) {
+        names = names + str_length((char *)included[i++ * 3 + 2]);
+    }
+
+    // identifiers declared by the included file, numbered in `Link`
+    m = 0;
+    id = (int *)frame[ISymbols];
+    while (id[Token]) {
+        if (id[Class]) {
+            id[Link] = m++;
+            names = names + id_length((char *)id[Name]) + 1;
+        }
+        id = id + IdSize;
+    }
+    names = (names + sizeof(int) - 1) & -sizeof(int);
+
+    i = (CHeader + nested * CNested + m * CId + 2 * n) * sizeof(int) + names + size;
+    if (!(obj = malloc(i))) {
+        printf("Could not malloc(%d) for cache\n", i);
+        exit(-1);
+    }
+    memset(obj, 0, i);
+    obj[0]  = CACHEMAGIC;
+    obj[1]  = EXIT + (opt_level << 8);
+    obj[2]  = frame[IHash];
+    obj[3]  = frame[ILen];
+    obj[4]  = n;
+    obj[5]  = size;
+    obj[6]  = m;
+    obj[7]  = names;
+    obj[8]  = nested;
+    obj[9]  = (int)(start + 1);
+    obj[10] = frame[IData];
+
+    p = obj + CHeader;
+    c = (char *)(p + nested * CNested + m * CId);
+    i = frame[IIncluded];
+    while (i<num_included) {
+        path = (char *)included[i * 3 + 2];
+        *p++ = included[i * 3];
+        *p++ = included[i * 3 + 1];
+        *p++ = str_length(path);
+        while (*path) *c++ = *path++;
+        i++;
+    }
+
+    id = (int *)frame[ISymbols];
+    while (id[Token]) {
+        if (id[Class]) {
+            *p++ = id[Token];
+            *p++ = id[Class];
+            *p++ = id[Type];
+            *p++ = id[Value];
+            *p++ = id[Hash];
+            *p++ = i = id_length((char *)id[Name]);
+            path = (char *)id[Name];
+            while (i--) *c++ = *path++;
+            c++;   // the names are terminated, as they are used in place
+        }
+        id = id + IdSize;
+    }
+
+    p = (int *)((int)p + names);
+    i = 0;
+    while (i<n) {
+        p[i] = start[i + 1];
+        p[n + i] = tags[start - old_text + i + 1];
+        if (p[n + i]>RDATA) {
+            id = (int *)p[n + i];
+            p[n + i] = id[Link] + 2;
+        }
+        i++;
+    }
+
+    c = (char *)(p + 2 * n);
+    i = 0;
+    while (i<size) {
+        c[i] = ((char *)frame[IData])[i];
+        i++;
+    }
+    obj[11] = content_hash((char *)(obj + CHeader), (int)c + size - (int)(obj + CHeader));
+
+    // the cache is optional, a failure to write it is ignored. It is written
+    // to a temporary file which then replaces the cache at once, so a reader
+    // never maps a cache which is half written
+    path = (char *)included[(frame[IIncluded] - 1) * 3 + 2];
+    file = copy_string(path, str_length(path), ".c4c.tmp");
+    if ((fd = open(file, 577, 420)) >= 0) { // O_WRONLY | O_CREAT | O_TRUNC, 0644
+        i = (int)c + size - (int)obj;
+        n = write(fd, obj, i);
+        close(fd);
+        if (n==i) {
+            rename(file, copy_string(path, str_length(path), ".c4c"));
+        }
+    }
+}
+
+int valid_cache(int *c, int len) {
+    // whether the counts of a cache file of `len` bytes fit its length, and
+    // the names and tags stay inside their parts
+    int i, n, m, nested, names, *p;
+
+    if (len<CHeader * sizeof(int)) {
+        return 0;
+    }
+    i = 4;
+    while (i<9) {
+        if (c[i]<0 || c[i]>len) {
+            return 0;
+        }
+        i++;
+    }
+    n = c[4];
+    m = c[6];
+    names = c[7];
+    nested = c[8];
+    if ((names & (sizeof(int) - 1)) ||
+        len!=(CHeader + nested * CNested + m * CId + 2 * n) * sizeof(int) + names + c[5] ||
+        content_hash((char *)(c + CHeader), len - CHeader * sizeof(int))!=c[11]) {
+        return 0;
+    }
+
+    p = c + CHeader;
+    i = 0;
+    while (i<nested) {
+        if (p[2]<0 || (names = names - p[2])<0) {
+            return 0;
+        }
+        p = p + CNested;
+        i++;
+    }
+    i = 0;
+    while (i<m) {
+        if (p[5]<0 || (names = names - p[5] - 1)<0) {
+            return 0;
+        }
+        p = p + CId;
+        i++;
+    }
+
+    p = (int *)((int)p + c[7]) + n;
+    i = 0;
+    while (i<n) {
+        if (p[i]<0 || p[i]>m + 1) {
+            return 0;
+        }
+        i++;
+    }
+    return 1;
+}
+
+int replay_cache(char *path, int hash, int len) {
+    // load the result of compiling an included file from its cache
+    int i, m, n, nested, tdelta, ddelta, value, *c, *p, *id, *map;
+    char *name, *file, *buf;
+
+    // a cache which is truncated or corrupted is ignored like a stale one,
+    // and the file is compiled from its source
+    if (!(c = (int *)map_file(copy_string(path, str_length(path), ".c4c")))) {
+        return 0;
+    }
+    if (c[0]!=CACHEMAGIC || c[1]!=EXIT + (opt_level << 8) || c[2]!=hash || c[3]!=len ||
+        !valid_cache(c, map_len)) {
+        return 0;
+    }
+    n = c[4];
+    m = c[6];
+    nested = c[8];
+
+    // the files it includes must be unchanged, and not included yet
+    p = c + CHeader;
+    name = (char *)(p + nested * CNested + m * CId);
+    i = 0;
+    while (i<nested) {
+        file = copy_string(name, p[2], "");
+        if (is_included(p[0], p[1]) || !(buf = map_file(file))) {
+            return 0;
+        }
+        len = str_length(buf);
+        if (len!=p[1] || content_hash(buf, len)!=p[0]) {
+            return 0;
+        }
+        name = name + p[2];
+        p = p + CNested;
+        i++;
+    }
+
+    // the identifiers it declares must be new
+    i = 0;
+    while (i<m) {
+        if (lookup(p[4], name, p[5])[Class]) {
+            return 0;
+        }
+        name = name + p[5] + 1;
+        p = p + CId;
+        i++;
+    }
+
+    p = c + CHeader;
+    name = (char *)(p + nested * CNested + m * CId);
+    i = 0;
+    while (i<nested) {
+        add_included(p[0], p[1], copy_string(name, p[2], ""));
+        name = name + p[2];
+        p = p + CNested;
+        i++;
+    }
+
+    data = (char *)(((int)data + sizeof(int) - 1) & -sizeof(int));
+    tdelta = (int)(text + 1) - c[9];
+    ddelta = (int)data - c[10];
+    if (!(map = malloc(m * sizeof(int) + 1))) {
+        printf("Could not malloc(%d) for cache\n", m * sizeof(int) + 1);
+        exit(-1);
+    }
+    i = 0;
+    while (i<m) {
+        id = lookup(p[4], name, p[5]);
+        value = p[3];
+        if (p[1]==Fun && value) {
+            value = value + tdelta;
+        } else if (p[1]==Glo) {
+            value = value + ddelta;
+        }
+        id[Token] = p[0];
+        id[Class] = p[1];
+        id[Type]  = p[2];
+        id[Value] = value;
+        map[i++] = (int)id;
+        name = name + p[5] + 1;
+        p = p + CId;
+    }
+
+    p = (int *)((int)(c + CHeader + nested * CNested + m * CId) + c[7]);
+    load_text(p, p + n, n, tdelta, ddelta, map);
+    load_data((char *)(p + 2 * n), c[5]);
+    return 1;
+}
+
+char *include_path(char *name, int len) {
+    // path of an included file, relative to the including file
+    char *p;
+    int n;
+
+    n = 0;
+    if (*name!='/') {
+        p = src_path;
+        while (*p) {
+            if (*p=='/') {
+                n = p - src_path + 1;
+            }
+            p++;
+        }
+    }
+    return copy_string(src_path, n, copy_string(name, len, ""));
+}
+
+void begin_include(char *name, int len) {
+    // continue lexing from an included file
+    int hash, *frame, *id;
+    char *path, *buf;
+
+    path = include_path(name, len);
+    if (!(buf = map_file(path))) {
+        printf("%d: Could not open(%s)\n", line, path);
+        exit(-1);
+    }
+    len = str_length(buf);
+    hash = content_hash(buf, len);
+
+    // every file is included once
+    if (is_included(hash, len)) {
+        return ;
+    }
+    add_included(hash, len, path);
+
+    if (!in_function && replay_cache(path, hash, len)) {
+        return ;
+    }
+
+    if (include_depth>=INCMAX) {
+        printf("%d: Too many nested includes\n", line);
+        exit(-1);
+    }
+    frame = includes + ++include_depth * IncSize;
+    data = (char *)(((int)data + sizeof(int) - 1) & -sizeof(int));
+    id = symbols;
+    while (id[Token]) {
+        id = id + IdSize;
+    }
+    frame[ISrc]      = (int)src;
+    frame[ILine]     = line;
+    frame[IPath]     = (int)src_path;
+    frame[IHash]     = hash;
+    frame[ILen]      = len;
+    frame[IText]     = (int)text;
+    frame[IData]     = (int)data;
+    frame[ISymbols]  = (int)id;
+    frame[IIncluded] = num_included;
+    frame[ICache]    = !in_function;
+
+    src = buf;
+    src_path = path;
+    line = 1;
+}
+
+int end_include() {
+    // return to the including file at the end of an included one,
+    // and get the next character to lex
+    int *frame;
+    while (!*src && include_depth) {
+        frame = includes + include_depth * IncSize;
+        if (frame[ICache]) {
+            write_cache(frame);
+        }
+        src      = (char *)frame[ISrc];
+        line     = frame[ILine];
+        src_path = (char *)frame[IPath];
+        include_depth--;
+    }
+    return *src;
+}
+
+int *builtin(int token, int hash, char *name, int class, int value) {
+    // append a pre-built identifier to the symbol table
+    int *id;
+    id = curr_id;
+    id[Token] = token;
+    id[Hash]  = hash;
+    id[Name]  = (int)name;
+    id[Class] = class;
+    id[Type]  = class ? INT : 0;
+    id[Value] = value;
+    curr_id = curr_id + IdSize;
+    return id;
+}
+
+void init_symbols() {
+    // forget the identifiers of the last unit
+    grow(symbol_pool, (int)(symbols + 32 * IdSize));
+    curr_id = symbols;
+    while (curr_id[Token]) {
+        curr_id = curr_id + IdSize;
+    }
+    memset(symbols, 0, (int)curr_id - (int)symbols);
+
+    // keywords with special meaning
+    // which cannot be considered as a normal identifier
+    //   => one must add these special keywords to
+    //      symbol table before calling `next()`
+    // the hashes are computed ahead of time, the same way as `next()` does
+    curr_id = symbols;
+    builtin(Break,   46125310835,      "break",   0, 0);
+    builtin(Case,    316588856,        "case",    0, 0);
+    builtin(Char,    316737486,        "char",    0, 0);
+    builtin(Default, 1016010566441945, "default", 0, 0);
+    builtin(Else,    323179601,        "else",    0, 0);
+    builtin(Enum,    323223121,        "enum",    0, 0);
+    builtin(If,      15537,            "if",      0, 0);
+    builtin(Int,     2285231,          "int",     0, 0);
+    builtin(Return,  7872662206568,    "return",  0, 0);
+    builtin(Sizeof,  7943190200544,    "sizeof",  0, 0);
+    builtin(Switch,  7949673806360,    "switch",  0, 0);
+    builtin(While,   55899560153,      "while",   0, 0);
+
+    // add library to symbol table
+    builtin(Id, 355029218,          "open",     Sys, OPEN);
+    builtin(Id, 364320490,          "read",     Sys, READ);
+    builtin(Id, 46573419308,        "close",    Sys, CLOS);
+    builtin(Id, 7741414478277,      "printf",   Sys, PRTF);
+    builtin(Id, 7527561376392,      "malloc",   Sys, MALC);
+    builtin(Id, 7529432498249,      "memset",   Sys, MSET);
+    builtin(Id, 7529432153677,      "memcmp",   Sys, MCMP);
+    builtin(Id, 55931326559,        "write",    Sys, WRIT);
+    builtin(Id, 348610759,          "mmap",     Sys, MMAP);
+    builtin(Id, 162814841523697850, "mprotect", Sys, MPRT);
+    builtin(Id, 46573416962,        "clock",    Sys, CLCK);
+    builtin(Id, 50797976756,        "lseek",    Sys, LSEK);
+    builtin(Id, 7872642714506,      "rename",   Sys, RENM);
+    builtin(Id, 323437454,          "exit",     Sys, EXIT);
+
+    builtin(Char, 377243848, "void", 0, 0);      // handle void type
+    idmain = builtin(Id, 348352625, "main", 0, 0); // keep track of main
+    keywords_end = idmain;
+}
+
+void compile_unit(char *path) {
+    // compile or load one translation unit
+    char *buf;
+    int *start;
+
+    init_symbols();
+    buf = read_file(path);
+    if (*(int *)buf==OBJMAGIC) {
+        load_object((int *)buf);
+        return ;
+    }
 
+    start = text;
+    src = old_src = buf;
+    src_path = path;
+    line = 1;
+    num_included = 0;
     program();
+    export_unit(start);
+}
+
+int *find_case(int *table, int value) {
+    // binary search of the case tables after JBIN
+    //    <n> IMM <value> JMP <target> ... JMP <default>
+    // the values are sorted in ascending order
+    int lo, hi, mid, *entry;
+    lo = 0;
+    hi = *table;
+    while (lo<hi) {
+        mid = (lo + hi) / 2;
+        entry = table + 1 + 4 * mid;
+        if (entry[1]==value) {
+            return (int *)entry[3];
+        } else if (entry[1]<value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (int *)table[2 + 4 * *table];
+}
+
+// Loops of the forms below are run by MCPY, MFIL, SLEN and MSUM, see
+// `recognize_idioms()`, and take the addresses of their variables. A loop
+// enters them after its first test, so they run as `do ... while`. They
+// step like the loop does, through the addresses, unless the memory they
+// write misses the variables; then the variables are loaded once.
+int misses(int *var, int from, int to) {
+    // whether the variable at `var` is outside of the bytes from `from` to `to`
+    return (int)var + sizeof(int)<=from || (int)var>=to;
+}
+
+int copy_loop(int *d, int *s, int *n, int z) {
+    // do { *d++ = *s++; } while (n--);     elements of `z` bytes
+    int k, t, p, q, end, from;
+    k = *n;
+    end = *d + (k + 1) * z;
+    from = *s;
+    if (k>=0 && misses(d, *d, end) && misses(s, *d, end) && misses(n, *d, end)
+        && misses(d, from, from + (k + 1) * z) && misses(s, from, from + (k + 1) * z)
+        && misses(n, from, from + (k + 1) * z)) {
+        p = *d;
+        q = *s;
+        *d = end;
+        *s = q + (k + 1) * z;
+        *n = -1;
+        if (z==1) {
+            while (p<end) {
+                *(char *)p = *(char *)q;
+                p++;
+                q++;
+            }
+        } else {
+            while (p<end) {
+                *(int *)p = *(int *)q;
+                p = p + sizeof(int);
+                q = q + sizeof(int);
+            }
+        }
+        return 0;
+    }
+    t = 1;
+    while (t) {
+        p = *d;
+        *d = p + z;
+        q = *s;
+        *s = q + z;
+        if (z==1) {
+            *(char *)p = *(char *)q;
+        } else {
+            *(int *)p = *(int *)q;
+        }
+        t = *n;
+        *n = t - 1;
+    }
+    return t;
+}
+
+int fill_loop(int *d, int v, int *n, int z) {
+    // do { *d++ = v; } while (n--);        elements of `z` bytes
+    int k, t, p, end;
+    k = *n;
+    end = *d + (k + 1) * z;
+    if (k>=0 && misses(d, *d, end) && misses(n, *d, end)) {
+        p = *d;
+        *d = end;
+        *n = -1;
+        if (z==1) {
+            memset((char *)p, v, k + 1);
+        } else {
+            while (p<end) {
+                *(int *)p = v;
+                p = p + sizeof(int);
+            }
+        }
+        return 0;
+    }
+    t = 1;
+    while (t) {
+        p = *d;
+        *d = p + z;
+        if (z==1) {
+            *(char *)p = v;
+        } else {
+            *(int *)p = v;
+        }
+        t = *n;
+        *n = t - 1;
+    }
+    return t;
+}
+
+int scan_loop(int *p, int z) {
+    // do { p++; } while (*p);              elements of `z` bytes
+    int t;
+    t = 1;
+    while (t) {
+        *p = *p + z;
+        t = (z==1) ? *(char *)*p : *(int *)*p;
+    }
+    return t;
+}
+
+int sum_loop(int *s, int *i, int *a, int n) {
+    // do { s = s + a[i]; i++; } while (i < n);
+    int t;
+    t = 1;
+    while (t) {
+        *s = *(int *)(*a + *i * sizeof(int)) + *s;
+        *i = *i + 1;
+        t = *i<n;
+    }
+    return t;
+}
+
+int sys_call(int op, int *sp, int n) {
+    // the built-in function `op`, whose `n` arguments are on the stack at `sp`
+    int *tmp;
+    tmp = sp + n;
+    switch (op) {
+    case OPEN: return open((char *)tmp[-1], tmp[-2], tmp[-3]);
+    case CLOS: return close(*sp);
+    case READ: return read(sp[2], (char *)sp[1], *sp);
+    case PRTF: return printf((char *)tmp[-1], tmp[-2], tmp[-3], tmp[-4], tmp[-5], tmp[-6]);
+    case MALC: return (int)malloc(*sp);
+    case MSET: return (int)memset((char *)sp[2], sp[1], *sp);
+    case MCMP: return memcmp((char *)sp[2], (char *)sp[1], *sp);
+    case WRIT: return write(sp[2], (char *)sp[1], *sp);
+    case MMAP: return (int)mmap((char *)sp[5], sp[4], sp[3], sp[2], sp[1], *sp);
+    case MPRT: return mprotect((char *)sp[2], sp[1], *sp);
+    case CLCK: return clock();
+    case LSEK: return lseek(sp[2], sp[1], *sp);
+    case RENM: return rename((char *)sp[1], (char *)*sp);
+    case MCPY: return copy_loop((int *)tmp[-1], (int *)tmp[-2], (int *)tmp[-3], *sp);
+    case MFIL: return fill_loop((int *)tmp[-1], tmp[-2], (int *)tmp[-3], *sp);
+    case SLEN: return scan_loop((int *)sp[1], *sp);
+    case MSUM: return sum_loop((int *)tmp[-1], (int *)tmp[-2], (int *)tmp[-3], *sp);
+    }
+    return 0;
+}
+
+int *memo_call(int *f, int *ret) {
+    // look the arguments of a call of the memoized function `f` up, they are
+    // on the stack and their number is in the `ADJ` at `ret`; returns 0 if
+    // the result is cached, which is loaded then, and the return address
+    // of the call otherwise
+    int *m, *slot, n, i, h;
+    m = memos;
+    while ((int *)m[MFun]!=f) {
+        m = m + MemoSize;
+    }
+    m[MCalls]++;
+    n = ret[1];
+    if (n>MEMO_ARGS) {
+        return ret;
+    }
+    h = 0;
+    i = 0;
+    while (i<n) {
+        h = h * 31 + sp[i++];
+    }
+    slot = (int *)m[MTable] + (MEMO_ARGS + 2) * (h & (MEMO_SLOTS - 1));
+    i = 0;
+    while (slot[0] && i<n && slot[i + 1]==sp[i]) {
+        i++;
+    }
+    if (slot[0] && i==n) {
+        m[MHits]++;
+        gpr = slot[MEMO_ARGS + 1];
+        return 0;
+    }
+    if (memo_depth>=MEMO_DEPTH) {
+        return ret;
+    }
+
+    // remember the arguments until it returns
+    slot = memo_stack + (MEMO_ARGS + 3) * memo_depth++;
+    slot[0] = (int)m;
+    slot[1] = n;
+    i = 0;
+    while (i<n) {
+        slot[i + 2] = sp[i];
+        i++;
+    }
+    slot[MEMO_ARGS + 2] = (int)ret;
+    return memo_stub;
+}
+
+int *memo_return() {
+    // store the result of the call which returns, returns its return address
+    int *call, *m, *slot, n, i, h;
+    call = memo_stack + (MEMO_ARGS + 3) * --memo_depth;
+    m = (int *)call[0];
+    n = call[1];
+    h = 0;
+    i = 0;
+    while (i<n) {
+        h = h * 31 + call[2 + i++];
+    }
+    slot = (int *)m[MTable] + (MEMO_ARGS + 2) * (h & (MEMO_SLOTS - 1));
+    slot[0] = 1;
+    i = 0;
+    while (i<n) {
+        slot[i + 1] = call[2 + i];
+        i++;
+    }
+    slot[MEMO_ARGS + 1] = gpr;
+    return (int *)call[MEMO_ARGS + 2];
+}
+
+void memo_report() {
+    // report the hit rate of the cache of every memoized function
+    int *m;
+    m = memos;
+    while (m<memos + MemoSize * num_memos) {
+        printf("memo %.*s: %d calls, %d hits", m[MLen], (char *)m[MName], m[MCalls], m[MHits]);
+        if (m[MCalls]) {
+            printf(" (%d%%)", m[MHits] * 100 / m[MCalls]);
+        }
+        printf("\n");
+        m = m + MemoSize;
+    }
+}
+
+int eval() {
+    int op, *tmp;
+    while (1) {
+        op = *pc++;                                                            // Get next operation
+        switch (op) {
+        case IMM:  gpr = *pc++; break;                                         // load IMMediate
+        case LC:   gpr = *(char *)gpr; break;                                  // Load Character
+        case LI:   gpr = *(int *)gpr; break;                                   // Load Integer
+        case SC:   *(char *)*sp++ = gpr; break;                                // Save Character
+        case SI:   *(int *)*sp++ = gpr; break;                                 // Save Integer
+        case PUSH: *--sp = gpr; break;                                         // PUSH value onto the stack
+
+        // jump (branch)
+        case JMP:  pc = (int *)*pc; break;                                     // JuMP to the address
+        case JZ:   pc = gpr ? pc + 1 : (int *)*pc; break;                      // Jump if (gpr==0)
+        case JNZ:  pc = gpr ? (int *)*pc : pc + 1; break;                      // Jump if Not (gpr==0)
+        case JTAB: pc = (int *)pc[gpr>=0 && gpr<*pc ? 2 * gpr + 2 : 2 * *pc + 2]; break; // Jump through TABle
+        case JBIN: pc = find_case(pc, gpr); break;                             // Jump by BINary search
+
+        // function call
+        // CALL enters the function too, with the frame size in its `ENT`,
+        // which is -1 for a function without frame, and the function
+        // returns past the `ADJ` after the call, popping the arguments
+        // a memoized function, marked by `MENT`, is not entered if the
+        // result for the arguments is cached, see `memo_call()`
+        case CALL: tmp = pc + 1;
+                   if (*(int *)*pc==MENT && !(tmp = memo_call((int *)*pc, tmp))) {
+                       sp = sp + pc[2]; pc = pc + 3; break;
+                   }
+                   *--sp = (int)tmp; pc = (int *)*pc;                           // CALL subroutine
+                   if (pc[1]>=0) { *--sp = (int)bp; bp = sp; sp = sp - pc[1]; }
+                   pc = pc + 2; break;
+        case ENT:  *--sp = (int)bp; bp = sp; sp = sp - *pc++; break;           // ENTer, to make new stack frame
+        case ADJ:  sp = sp + *pc++; break;                                     // pop all args from frame
+        case LEV:  sp = bp; bp = (int *)*sp++; pc = (int *)*sp++;              // LEaVe subroutine, which is 'pop and return'
+                   sp = sp + pc[1]; pc = pc + 2; break;
+        case RET:  pc = (int *)*sp++; sp = sp + pc[1]; pc = pc + 2; break;     // RETurn from a function without frame
+        case MRET: pc = memo_return(); sp = sp + pc[1]; pc = pc + 2; break;     // return from a memoized function
+        case LEA:  gpr = (int)(bp + *pc++); break;                             // Load Effective Address, load the args
+        case LSP:  gpr = sp[*pc++]; break;                                     // Load relative to Stack Pointer, args of inlined calls
+        case INC:  tmp = (int *)gpr; gpr = *tmp = *tmp + *pc++; break;         // INCrement the int at the address in place
+
+        // Arithmetic operations
+        case OR:   gpr = *sp++ |  gpr; break;
+        case XOR:  gpr = *sp++ ^  gpr; break;
+        case AND:  gpr = *sp++ &  gpr; break;
+        case EQ:   gpr = *sp++ == gpr; break;
+        case NE:   gpr = *sp++ != gpr; break;
+        case LT:   gpr = *sp++ <  gpr; break;
+        case LE:   gpr = *sp++ <= gpr; break;
+        case GT:   gpr = *sp++ >  gpr; break;
+        case GE:   gpr = *sp++ >= gpr; break;
+        case SHL:  gpr = *sp++ << gpr; break;
+        case SHR:  gpr = *sp++ >> gpr; break;
+        case ADD:  gpr = *sp++ +  gpr; break;
+        case SUB:  gpr = *sp++ -  gpr; break;
+        case MUL:  gpr = *sp++ *  gpr; break;
+        case DIV:  gpr = *sp++ /  gpr; break;
+        case MOD:  gpr = *sp++ %  gpr; break;
+        case NEG:  gpr = -gpr; break;
+
+        // Built-in Instructions, the number of arguments of printf() and
+        // open() is the operand of the `ADJ` after them
+        case EXIT: if (num_memos) { memo_report(); }
+                   printf("exit(%d)", *sp); return *sp;
+        case OPEN: case CLOS: case READ: case PRTF: case MALC: case MSET: case MCMP:
+        case WRIT: case MMAP: case MPRT: case CLCK: case LSEK: case RENM:
+        case MCPY: case MFIL: case SLEN: case MSUM:
+            gpr = sys_call(op, sp, pc[1]); break;
+        default:
+            printf("Unknown instruction: %d\n", op);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// ----- Register Machine ----- //
+// With `-r`, the program runs on a register machine instead, whose code is
+// translated from the stack code of the whole program after linking. The
+// registers are the words of the frame, named by their offsets to bp like
+// the operands of `LEA`:
+//    bp[2], ...:          arguments
+//    bp[-1], ...:         locals
+//    bp[-locals - 1 - i]: the i-th word pushed on the stack by the stack code
+// and the register gpr of the stack code is the register of the next word.
+// Values which are only moved around by the stack code (constants, locals,
+// addresses of locals) are used where they are needed, so a binary operator
+// on a local and a constant is one instruction instead of five.
+//
+// Instructions take 4 words, `<op> <x> <y> <z>`, where Z is the register
+// `z`, or `z` itself when `op` has RK set:
+//    MOV  d _ z        R[d] = Z
+//    LEA  d n _        R[d] = bp + n
+//    LI   d a _        R[d] = *(int *)R[a]        (LC: char)
+//    SI   _ a z        *(int *)R[a] = Z           (SC: char)
+//    INC  d a k        R[d] = *(int *)R[a] += k
+//    <op> d a z        R[d] = R[a] <op> Z         (OR ... MOD)
+//    NEG  d a _        R[d] = -R[a]
+//    JMP  t _ _        goto t
+//    JZ   t _ z        goto t if Z is 0           (JNZ: if not 0)
+//    JTAB n _ z        goto the Z-th of the next n `JMP t`, or the last
+//    JBIN r _ n        goto the `IMM <v> JMP <t>` of the next n whose v is R[r],
+//                      or the `JMP t` after them
+//    CALL f s d        call f with the stack at bp + s, the result goes to R[d]
+//    ENT  _ _ _        the beginning of a function, not executed
+//    LEV  _ _ z        return Z
+//    <sys> d s n       R[d] = the built-in function of the n arguments at bp + s
+// A frame is made by CALL, and holds the old bp and the return address:
+//    bp[0]: old bp
+//    bp[1]: return address, which follows the CALL and its `d`
+int registers;          // run on the register machine
+int *rtext, *old_rtext; // register code
+int *rmap;              // register code of every word of text, 1 at the labels
+int *rdesc;             // values on the stack of the stack code: kind, value
+int rdepth;             // number of words on it
+int rlocals;            // number of locals of the function
+int *rtext_pool, *rmap_pool, *rdesc_pool;
+enum { MOV = 64, RK = 128 };
+// kinds of values: in a register, a constant, or the address bp + value
+enum { KReg, KImm, KAddr };
+
+int reg_of(int i) {
+    // register of the i-th word of the stack
+    return -rlocals - 1 - i;
+}
+
+int *operand(int i) {
+    // the i-th word of the stack, -1 for gpr
+    grow(rdesc_pool, (int)(rdesc + 2 * i + 4));
+    return rdesc + 2 * i + 2;
+}
+
+void set_operand(int *o, int kind, int value) {
+    o[0] = kind;
+    o[1] = value;
+}
+
+void remit(int op, int x, int y, int z) {
+    // emit a register instruction
+    grow(rtext_pool, (int)(rtext + 5));
+    *++rtext = op;
+    *++rtext = x;
+    *++rtext = y;
+    *++rtext = z;
+}
+
+int in_reg(int *o, int r) {
+    // register holding the value, which is loaded into `r` if needed
+    if (o[0]==KImm) {
+        remit(MOV | RK, r, 0, o[1]);
+    } else if (o[0]==KAddr) {
+        remit(LEA, r, o[1], 0);
+    } else {
+        return o[1];
+    }
+    return r;
+}
+
+void remit_z(int op, int x, int y, int *o, int r) {
+    // emit an instruction whose `z` is the value `o`, a constant or a register
+    if (o[0]==KImm) {
+        remit(op | RK, x, y, o[1]);
+    } else {
+        remit(op, x, y, in_reg(o, r));
+    }
+}
+
+void move_to(int r, int *o) {
+    // move the value into register `r`, where it is from now on
+    if (o[0]==KAddr) {
+        remit(LEA, r, o[1], 0);
+    } else if (o[0]!=KReg || o[1]!=r) {
+        remit_z(MOV, r, 0, o, r);
+    }
+    set_operand(o, KReg, r);
+}
+
+void spill(int var) {
+    // move the words of the stack which are the variable `var`, or any
+    // variable if it is 0, to their own registers before it is stored to
+    int i, *o;
+    i = 0;
+    while (i<rdepth) {
+        o = operand(i);
+        if (o[0]==KReg && o[1]>=-rlocals && (!var || o[1]==var)) {
+            move_to(reg_of(i), o);
+        }
+        i++;
+    }
+}
+
+void canonical(int live) {
+    // move the words of the stack to their own registers, and gpr to the
+    // register of the next word if it is `live`, which is the state at labels
+    int i;
+    i = 0;
+    while (i<rdepth) {
+        move_to(reg_of(i), operand(i));
+        i++;
+    }
+    if (live) {
+        move_to(reg_of(rdepth), operand(-1));
+    }
+}
+
+int reads_gpr(int *p) {
+    // whether the stack instruction at `p` may use the value of gpr
+    return *p!=IMM && *p!=LEA && *p!=LSP;
+}
+
+int *translate(int *p) {
+    // translate the stack instruction at `p`, returns the next one
+    int op, n, r, *a, *g, *q;
+
+    op = *p;
+    q = p + 1 + has_arg(op);
+    g = operand(-1);
+    if (op==ENT) {
+        // ENT -1 of a function without frame
+        rlocals = (p[1]>0) ? p[1] : 0;
+        rdepth = 0;
+        set_operand(g, KReg, reg_of(0));
+        remit(ENT, 0, 0, 0);
+
+    } else if (op==IMM) {
+        set_operand(g, KImm, p[1]);
+    } else if (op==LEA) {
+        set_operand(g, KAddr, p[1]);
+    } else if (op==LSP && p[1]<rdepth) {
+        a = operand(rdepth - 1 - p[1]);
+        set_operand(g, a[0], a[1]);
+    } else if (op==LSP) {
+        // arguments of a function without frame, past its return address
+        set_operand(g, KReg, 1 + p[1] - rdepth);
+    } else if (op==PUSH) {
+        if (g[0]==KReg && g[1]<reg_of(rdepth)) {
+            // the register of a word which is popped, and may be reused
+            move_to(reg_of(rdepth), g);
+        }
+        a = operand(rdepth++);
+        set_operand(a, g[0], g[1]);
+
+    } else if (op==LI && g[0]==KAddr) {
+        // load of a local
+        set_operand(g, KReg, g[1]);
+    } else if (op==NEG && g[0]==KImm) {
+        g[1] = -g[1];
+    } else if (op==LI || op==LC || op==NEG) {
+        r = reg_of(rdepth);
+        remit(op, r, in_reg(g, r), 0);
+        set_operand(g, KReg, r);
+
+    } else if (op==SI && operand(rdepth - 1)[0]==KAddr) {
+        // store to a local
+        a = operand(--rdepth);
+        spill(a[1]);
+        move_to(a[1], g);
+    } else if (op==INC && g[0]==KAddr) {
+        spill(g[1]);
+        remit(ADD | RK, g[1], g[1], p[1]);
+        set_operand(g, KReg, g[1]);
+    } else if (op==SI || op==SC) {
+        // store through a pointer, which may be to any variable
+        a = operand(--rdepth);
+        spill(0);
+        remit_z(op, 0, in_reg(a, reg_of(rdepth)), g, reg_of(rdepth + 1));
+    } else if (op==INC) {
+        spill(0);
+        r = reg_of(rdepth);
+        remit(INC | RK, r, in_reg(g, r), p[1]);
+        set_operand(g, KReg, r);
+
+    } else if (op>=OR && op<=MOD) {
+        // the left operand is popped, and the result goes to its register
+        a = operand(--rdepth);
+        r = reg_of(rdepth);
+        if (a[0]==KImm && g[0]==KImm && foldable(op, a[1], g[1])) {
+            set_operand(g, KImm, fold(op, a[1], g[1]));
+        } else {
+            if (a[0]==KImm && g[0]!=KImm && (op==ADD || op==MUL || op==AND || op==OR
+                || op==XOR || op==EQ || op==NE)) {
+                // the constant goes to the right of commutative operators
+                n = a[1];
+                set_operand(a, g[0], g[1]);
+                set_operand(g, KImm, n);
+            }
+            n = (g[0]==KReg && g[1]==r) ? reg_of(rdepth + 1) : r;
+            remit_z(op, r, in_reg(a, n), g, reg_of(rdepth + 1));
+            set_operand(g, KReg, r);
+        }
+
+    } else if (op==JMP) {
+        canonical(reads_gpr((int *)p[1]));
+        remit(JMP, p[1], 0, 0);
+    } else if (op==JZ || op==JNZ) {
+        canonical(reads_gpr((int *)p[1]));
+        remit_z(op, p[1], 0, g, reg_of(rdepth));
+    } else if (op==JTAB) {
+        canonical(0);
+        remit_z(JTAB, p[1], 0, g, reg_of(rdepth));
+        n = p[1] + 1;
+        while (n--) {
+            remit(JMP, q[1], 0, 0);
+            q = q + 2;
+        }
+    } else if (op==JBIN) {
+        canonical(0);
+        remit(JBIN | RK, in_reg(g, reg_of(rdepth)), 0, p[1]);
+        n = p[1];
+        while (n--) {
+            remit(IMM, q[1], JMP, q[3]);
+            q = q + 4;
+        }
+        remit(JMP, q[1], 0, 0);
+        q = q + 2;
+
+    } else if (op==CALL || (op>=OPEN && op<=EXIT)) {
+        // the arguments are in their registers, the callee may change any
+        // variable, and the `ADJ` after the call pops them
+        n = (*q==ADJ) ? q[1] : 0;
+        canonical(0);
+        rdepth = rdepth - n;
+        r = reg_of(rdepth);
+        if (op==CALL) {
+            remit(CALL, p[1], reg_of(rdepth + n - 1), r);
+        } else {
+            remit(op | RK, r, reg_of(rdepth + n - 1), n);
+        }
+        set_operand(g, KReg, r);
+        if (*q==ADJ) {
+            q = q + 2;
+        }
+    } else if (op==ADJ) {
+        rdepth = rdepth - p[1];
+    } else if (op==LEV || op==RET) {
+        remit_z(LEV, 0, 0, g, reg_of(rdepth));
+    } else {
+        printf("Unknown instruction: %d\n", op);
+        exit(-1);
+    }
+    return q;
+}
+
+int *translate_image(int *entry) {
+    // translate the whole text into register code, returns the code which
+    // calls main() at `entry` and exits with its result
+    int *p, op, n, *stub;
+
+    rtext_pool = new_pool("register", poolsz);
+    rmap_pool = new_pool("register map", poolsz);
+    rdesc_pool = new_pool("register stack", poolsz);
+    rtext = old_rtext = (int *)rtext_pool[PBase];
+    rmap = (int *)rmap_pool[PBase];
+    rdesc = (int *)rdesc_pool[PBase];
+    grow(rmap_pool, (int)(rmap + (text - old_text) + 1));
+
+    // mark the labels
+    p = old_text + 1;
+    while (p<=text) {
+        if (is_jump(*p)) {
+            rmap[(int *)p[1] - old_text] = 1;
+        }
+        p = p + 1 + has_arg(*p);
+    }
+
+    p = old_text + 1;
+    while (p<=text) {
+        if (rmap[p - old_text]) {
+            canonical(reads_gpr(p));
+            set_operand(operand(-1), KReg, reg_of(rdepth));
+        }
+        rmap[p - old_text] = (int)(rtext + 1);
+        p = translate(p);
+    }
+    stub = rtext + 1;
+    remit(CALL, (int)entry, 2, 1);
+    remit(EXIT | RK, 0, 1, 0);
+
+    // jumps and calls go to the register code
+    p = old_rtext + 1;
+    while (p<=rtext) {
+        op = *p & (RK - 1);
+        if (op==JBIN) {
+            n = p[3];
+            while (n--) {
+                p = p + 4;
+                p[3] = rmap[(int *)p[3] - old_text];
+            }
+        } else if (is_jump(op) || op==CALL) {
+            p[1] = rmap[(int *)p[1] - old_text];
+        }
+        p = p + 4;
+    }
+    return stub;
+}
+
+int reval() {
+    // run the register code
+    int op, z, *ins, *tmp;
+    while (1) {
+        ins = pc;
+        pc = pc + 4;
+        op = *ins;
+        z = (op & RK) ? ins[3] : bp[ins[3]];
+        switch (op & (RK - 1)) {
+        case MOV:  bp[ins[1]] = z; break;
+        case LEA:  bp[ins[1]] = (int)(bp + ins[2]); break;
+        case LI:   bp[ins[1]] = *(int *)bp[ins[2]]; break;
+        case LC:   bp[ins[1]] = *(char *)bp[ins[2]]; break;
+        case SI:   *(int *)bp[ins[2]] = z; break;
+        case SC:   *(char *)bp[ins[2]] = z; break;
+        case INC:  tmp = (int *)bp[ins[2]]; bp[ins[1]] = *tmp = *tmp + z; break;
+
+        case JMP:  pc = (int *)ins[1]; break;
+        case JZ:   pc = z ? pc : (int *)ins[1]; break;
+        case JNZ:  pc = z ? (int *)ins[1] : pc; break;
+        case JTAB: pc = (int *)ins[4 * (z>=0 && z<ins[1] ? z : ins[1]) + 5]; break;
+        case JBIN: pc = find_case(ins + 3, bp[ins[1]]); break;
+
+        case CALL: sp = bp + ins[2]; *--sp = (int)pc; *--sp = (int)bp; bp = sp; pc = (int *)ins[1] + 4; break;
+        case LEV:  tmp = bp; bp = (int *)*tmp; pc = (int *)tmp[1]; bp[pc[-1]] = z; break;
+
+        case OR:   bp[ins[1]] = bp[ins[2]] |  z; break;
+        case XOR:  bp[ins[1]] = bp[ins[2]] ^  z; break;
+        case AND:  bp[ins[1]] = bp[ins[2]] &  z; break;
+        case EQ:   bp[ins[1]] = bp[ins[2]] == z; break;
+        case NE:   bp[ins[1]] = bp[ins[2]] != z; break;
+        case LT:   bp[ins[1]] = bp[ins[2]] <  z; break;
+        case LE:   bp[ins[1]] = bp[ins[2]] <= z; break;
+        case GT:   bp[ins[1]] = bp[ins[2]] >  z; break;
+        case GE:   bp[ins[1]] = bp[ins[2]] >= z; break;
+        case SHL:  bp[ins[1]] = bp[ins[2]] << z; break;
+        case SHR:  bp[ins[1]] = bp[ins[2]] >> z; break;
+        case ADD:  bp[ins[1]] = bp[ins[2]] +  z; break;
+        case SUB:  bp[ins[1]] = bp[ins[2]] -  z; break;
+        case MUL:  bp[ins[1]] = bp[ins[2]] *  z; break;
+        case DIV:  bp[ins[1]] = bp[ins[2]] /  z; break;
+        case MOD:  bp[ins[1]] = bp[ins[2]] %  z; break;
+        case NEG:  bp[ins[1]] = -bp[ins[2]]; break;
+
+        case EXIT: printf("exit(%d)", bp[ins[2]]); return bp[ins[2]];
+        case OPEN: case CLOS: case READ: case PRTF: case MALC: case MSET: case MCMP:
+        case WRIT: case MMAP: case MPRT: case CLCK: case LSEK: case RENM:
+        case MCPY: case MFIL: case SLEN: case MSUM:
+            bp[ins[1]] = sys_call(op & (RK - 1), bp + ins[2], z); break;
+        default:
+            printf("Unknown instruction: %d\n", op);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int i, n;
+    int *tmp;
+    char **units, *out;
+
+    --argc;
+    ++argv;
+    poolsz = 1 << 30;     // reserved address space of each section
+
+    // options
+    //    -u <file>: additional translation unit, either source or object
+    //    -o <file>: write all units into an object file instead of running
+    //    -t:        report the startup latency before the first instruction
+    //    -O:        optimize the code of every function
+    //    -O2:       also follow the values of variables across the function
+    //    -v:        report the number of instructions of optimized functions
+    //    -r:        run on the register machine
+    //    -m:        cache the results of pure recursive functions
+    if (!(units = malloc(argc * sizeof(char *) + 1))) {
+        printf("Could not malloc(%d) for units\n", argc * sizeof(char *) + 1);
+        return -1;
+    }
+    n = 0;
+    out = 0;
+    timing = 0;
+    opt_level = 0;
+    verbose = 0;
+    registers = 0;
+    memoize = 0;
+    while (argc>1 && **argv=='-' && (*argv)[1]) {
+        if ((*argv)[1]=='t') {
+            timing = 1;
+        } else if ((*argv)[1]=='O' && (!(*argv)[2] || ((*argv)[2]=='2' && !(*argv)[3]))) {
+            opt_level = (*argv)[2] ? 2 : 1;
+        } else if ((*argv)[1]=='v') {
+            verbose = 1;
+        } else if ((*argv)[1]=='r') {
+            registers = 1;
+        } else if ((*argv)[1]=='m') {
+            memoize = 1;
+        } else if ((*argv)[1]=='u') {
+            --argc;
+            units[n++] = *++argv;
+        } else if ((*argv)[1]=='o') {
+            --argc;
+            out = *++argv;
+        } else {
+            printf("Unknown option %s\n", *argv);
+            printf("usage: expressions [-t] [-O[2]] [-v] [-r] [-m] [-u unit] [-o object] file ...\n");
+            return -1;
+        }
+        --argc;
+        ++argv;
+    }
+    if (argc<1) {
+        printf("usage: expressions [-t] [-O[2]] [-v] [-r] [-m] [-u unit] [-o object] file ...\n");
+        return -1;
+    }
+
+    // reserve memory for virtual machine, the pages are zero-filled
+    // and committed when the sections grow
+    text_pool   = new_pool("text", poolsz);
+    tags_pool   = new_pool("relocation", poolsz);
+    data_pool   = new_pool("data", poolsz);
+    symbol_pool = new_pool("symbol", poolsz);
+    link_pool   = new_pool("link", poolsz);
+    text = old_text = (int *)text_pool[PBase];
+    tags = (int *)tags_pool[PBase];
+    data = old_data = (char *)data_pool[PBase];
+    symbols = (int *)symbol_pool[PBase];
+    links = (int *)link_pool[PBase];
+    grow(link_pool, (int)links);
+    include_pool = new_pool("include", poolsz);
+    included = (int *)include_pool[PBase];
+    opt_pool = new_pool("optimizer", poolsz);
+    case_pool = new_pool("case", poolsz);
+    cases = (int *)case_pool[PBase];
+    if (!(includes = malloc((INCMAX + 1) * IncSize * sizeof(int)))) {
+        printf("Could not malloc(%d) for includes\n", (INCMAX + 1) * IncSize * sizeof(int));
+        return -1;
+    }
+
+    // the stack is committed at once, the kernel only backs the pages that
+    // are touched, and the lowest page is kept as a guard against overflow
+    stack = (int *)mmap(0, poolsz, PROT_RW, MAP_ANON_RESERVE, -1, 0);
+    if ((int)stack==-1 || mprotect((char *)stack, 4096, 0)) {
+        printf("Could not reserve %d bytes for stack area\n", poolsz);
+        return -1;
+    }
+
+    bp = sp = (int *)((int)stack + poolsz);
+    gpr = 0;
+
+    // compile every unit, the file to run comes last
+    i = 0;
+    while (i<n) {
+        compile_unit(units[i++]);
+    }
+    compile_unit(*argv);
+
+    if (out) {
+        return write_object(out);
+    }
+
+    if (link_image()<0 || (opt_level && strip_image()<0)) {
+        return -1;
+    }
 
-    if (!(pc = (int *)idmain[Value])) {
+    tmp = link_symbol(idmain[Hash], (char *)idmain[Name], 4, Fun, INT, 0);
+    if (!(pc = (int *)tmp[LValue])) {
         printf("main() not defined\n");
         return -1;
     }
 
-    // setup stack
-    sp = (int *)((int)stack + poolsz);
-    *--sp = EXIT;            // call exit if main returns
-    *--sp = PUSH; tmp = sp;
-    *--sp = argc;
-    *--sp = (int)argv;
-    *--sp = (int)tmp;
+    if (memoize && !registers) {
+        memoize_image();
+    }
+
+    if (registers) {
+        // the register code calls main() from a frame of its own,
+        // with argc and argv as the arguments of the call
+        pc = translate_image(pc);
+        bp = (int *)((int)stack + poolsz) - 4;
+        bp[3] = argc;
+        bp[2] = (int)argv;
+    } else {
+        // setup stack
+        sp = (int *)((int)stack + poolsz);
+        *--sp = EXIT;            // call exit if main returns
+        *--sp = PUSH;
+        *--sp = 2;               // main() pops argc and argv
+        *--sp = ADJ; tmp = sp;
+        *--sp = argc;
+        *--sp = (int)argv;
+        *--sp = (int)tmp;
+    }
 
-    return eval();
-}
\ No newline at end of file
+    if (timing) {
+        // CPU time (not wall-clock time) since the process started, in
+        // microseconds
+        printf("startup: %d us\n", (int)clock());
+    }
+    return registers ? reval() : eval();
+}
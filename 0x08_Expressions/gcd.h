@@ -0,0 +1,15 @@
+// Included by include.c, compiled once and cached in gcd.h.c4c.
+
+int calls;
+
+int gcd(int a, int b)
+{
+    calls++;
+    if (b == 0) return a;
+    return gcd(b, a % b);
+}
+
+int lcm(int a, int b)
+{
+    return a / gcd(a, b) * b;
+}
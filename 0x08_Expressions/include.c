@@ -0,0 +1,14 @@
+#include <stdio.h>
+#include "gcd.h"
+
+// The second run loads gcd.h from its cache:
+//     ./expressions include.c
+//     ./expressions -O2 include.c
+
+int main()
+{
+    printf("gcd(1071, 462) = %d\n", gcd(1071, 462));
+    printf("lcm(21, 6) = %d\n", lcm(21, 6));
+    printf("calls = %d\n", calls);
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <stdio.h>
+
+// With -O, these loops become single instructions which copy, fill, scan
+// or sum memory natively, and print the same:
+//     ./expressions loops.c
+//     ./expressions -O loops.c
+//     ./expressions -r -O loops.c
+
+int total;
+
+int main()
+{
+    char *buf, *d, *s, *p;
+    int *a, *w, *v, i, n, sum;
+
+    // Copy and scan chars.
+    buf = malloc(64);
+    d = buf;
+    s = "hello, world";
+    n = 13;
+    while (n--) *d++ = *s++;
+    p = buf;
+    while (*p) p++;
+    printf("%s: copied %d, length %d, n = %d\n", buf, d - buf, p - buf, n);
+
+    // Fill chars.
+    n = 5;
+    d = buf + 7;
+    while (n--) *d++ = '*';
+    printf("%s: n = %d\n", buf, n);
+
+    // Copy within the same buffer, one char at a time.
+    n = 6;
+    s = buf;
+    d = buf + 1;
+    while (n--) *d++ = *s++;
+    printf("%s\n", buf);
+
+    // Fill, copy and sum ints.
+    a = malloc(10 * sizeof(int));
+    w = a;
+    n = 10;
+    while (n--) *w++ = 0;
+    i = 0;
+    while (i < 10) {
+        a[i] = i * i;
+        i++;
+    }
+    v = malloc(10 * sizeof(int));
+    w = v;
+    n = 4;
+    while (n--) *w++ = *a++;
+    a = a - 4;
+    printf("copy: %d %d %d %d, %d\n", v[0], v[1], v[2], v[3], w - v);
+
+    i = 0;
+    sum = 0;
+    n = 10;
+    while (i < n) {
+        sum = sum + a[i];
+        i++;
+    }
+    printf("sum: %d, i = %d\n", sum, i);
+
+    i = 3;
+    total = 0;
+    while (i < 7) {
+        total = total + a[i];
+        i++;
+    }
+    printf("total: %d\n", total);
+    return 0;
+}
@@ -0,0 +1,39 @@
+#include <stdio.h>
+
+// With -m, the results of fib() and binomial() are cached, and a line
+// reports the hits of each when the program exits:
+//     ./expressions memo.c
+//     ./expressions -m memo.c
+
+int fib(int n)
+{
+    if (n < 2) return n;
+    return fib(n - 1) + fib(n - 2);
+}
+
+int binomial(int n, int k)
+{
+    if (k == 0 || k == n) return 1;
+    return binomial(n - 1, k - 1) + binomial(n - 1, k);
+}
+
+int count(char *s)
+{
+    // not cached: the argument is a pointer
+    if (!*s) return 0;
+    return count(s + 1) + (*s == 'o');
+}
+
+int main()
+{
+    int n;
+
+    n = 0;
+    while (n <= 24) {
+        printf("fib(%d) = %d\n", n, fib(n));
+        n = n + 8;
+    }
+    printf("binomial(20, 10) = %d\n", binomial(20, 10));
+    printf("count = %d\n", count("hello, world, foo"));
+    return 0;
+}
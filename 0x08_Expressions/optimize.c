@@ -0,0 +1,115 @@
+#include <stdio.h>
+
+// Every line is the same with and without the optimizations:
+//     ./expressions optimize.c
+//     ./expressions -O optimize.c
+//     ./expressions -O2 optimize.c
+//     ./expressions -r -O2 optimize.c
+// The exit code is the number of wrong results.
+
+int errors;
+
+int check(char *what, int got, int want)
+{
+    if (got == want) {
+        printf("%-10s %d\n", what, got);
+    } else {
+        printf("%-10s %d, expected %d\n", what, got, want);
+        errors++;
+    }
+    return 0;
+}
+
+int square(int x)
+{
+    return x * x;
+}
+
+int fib(int n)
+{
+    if (n < 2) return n;
+    return fib(n - 1) + fib(n - 2);
+}
+
+int quotient(int a, int b)
+{
+    return a / b;
+}
+
+int main()
+{
+    int a, b, c, i, n, s, t, u, zero, min, *p;
+
+    // Constants are folded, except the operations which would trap.
+    check("fold", 3 * 4 + 10 / 3 - (1 << 4) + (100 >> 2) % 7, 3);
+    min = -9223372036854775807 - 1;
+    zero = 0;
+    s = 0;
+    if (zero) {
+        s = (-9223372036854775807 - 1) / -1;
+        s = (-9223372036854775807 - 1) % -1;
+        s = 1 << 64;
+        s = 1 >> -1;
+        s = 1 / 0;
+        s = quotient(-9223372036854775807 - 1, -1);
+        s = quotient(1, 0);
+    }
+    check("trap", s, 0);
+    check("compile", fib(20) + quotient(100, 7), 6779);
+
+    // Peephole: x + 0, x * 1, -x, shifts for powers of two.
+    a = 7;
+    b = -7;
+    check("peephole", (a + 0) * 1 - -a + a * 8, 70);
+    check("division", b / 2 * 10 + b % 4, -33);
+    p = malloc(80);
+    check("pointer", (p + 10) - p, 10);
+
+    // Inlining of short functions.
+    check("inline", square(a) + square(b + 1), 85);
+
+    // Repeated expressions in a block.
+    c = 3;
+    s = (a + b * c) * (a + b * c) + (a + b * c);
+    b = 2;
+    s = s + (a + b * c);
+    check("common", s, 195);
+
+    // Invariant computations in a loop.
+    i = 0;
+    s = 0;
+    n = 10;
+    while (i < n) {
+        s = s + a * c + i;
+        i++;
+    }
+    check("hoist", s, 255);
+
+    // Unreachable code and jumps to jumps.
+    s = 1;
+    while (0) {
+        s = 2;
+    }
+    if (0) s = 3;
+    i = 0;
+    while (i < 3) {
+        if (i == 1) {
+            s = s + 10;
+        } else {
+            if (i == 2) s = s + 100;
+        }
+        i++;
+    }
+    check("branches", s, 111);
+
+    // Values followed through the function with -O2.
+    t = 5;
+    u = t;
+    s = u * 2;
+    if (t == 5) s = s + 1; else s = 0;
+    s = 4;
+    s = s + u;
+    check("propagate", s, 9);
+
+    return errors;
+}
@@ -0,0 +1,11 @@
+// A unit without main(), linked with units.c:
+//     ./expressions -o square.o square.c
+//     ./expressions -u square.o units.c
+
+int squares;
+
+int square(int x)
+{
+    squares++;
+    return x * x;
+}
@@ -0,0 +1,49 @@
+#include <stdio.h>
+
+// Dense cases jump through a table, sparse cases are binary searched:
+//     ./expressions switch.c
+//     ./expressions -O2 switch.c
+//     ./expressions -r switch.c
+
+char *day(int n)
+{
+    switch (n) {
+    case 0: return "Sunday";
+    case 1: return "Monday";
+    case 2: return "Tuesday";
+    case 3: return "Wednesday";
+    case 4: return "Thursday";
+    case 5: return "Friday";
+    case 6: return "Saturday";
+    }
+    return "none";
+}
+
+int code(int n)
+{
+    int r;
+    r = 0;
+    switch (n) {
+    case -1000: r = 1; break;
+    case -3: r = 2; break;
+    case 7: r = 3;
+    case 64: r = r + 4; break;
+    case 999999: r = 5; break;
+    default: r = 6;
+    }
+    return r;
+}
+
+int main()
+{
+    int i;
+
+    i = -1;
+    while (i < 8) {
+        printf("day(%d) = %s\n", i, day(i));
+        i++;
+    }
+    printf("code = %d %d %d %d\n", code(-1000), code(-3), code(7), code(64));
+    printf("code = %d %d %d\n", code(999999), code(0), code(65));
+    return 0;
+}
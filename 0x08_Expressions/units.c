@@ -0,0 +1,24 @@
+#include <stdio.h>
+
+// Calls square() of square.c, which is linked as an object file or
+// compiled with this unit:
+//     ./expressions -o square.o square.c
+//     ./expressions -u square.o units.c
+//     ./expressions -O2 -u square.c units.c
+
+int square(int x);
+int squares;
+
+int main()
+{
+    int i, sum;
+
+    i = 1;
+    sum = 0;
+    while (i <= 10) {
+        sum = sum + square(i);
+        i++;
+    }
+    printf("sum of squares = %d, squares = %d\n", sum, squares);
+    return 0;
+}